@@ -1,19 +1,128 @@
+#define _GNU_SOURCE	//clock_gettime, usleep, posix_fadvise, realpath and fseeko under -std=c11, ignored on Windows
 #define GLFW_DLL 1
 
 #define GL_GLEXT_PROTOTYPES
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLFW/glfw3.h>
 
 #include "linmath.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <setjmp.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+#include <sys/stat.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#ifdef _WIN32			//Offsets past 2 GB, long is 32 bits on Windows
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+enum {FILTER_NEAREST, FILTER_BILINEAR, FILTER_BICUBIC, FILTER_LANCZOS3, FILTER_COUNT};
+
+const char* FilterNames[FILTER_COUNT] = {"nearest", "bilinear", "bicubic", "lanczos3"};
+const double FilterTolerances[FILTER_COUNT] = {30, 40, 40, 40};	//Nearest flips whole texels where the paths round a
+																//tie differently, the others only drift by a level or two
+
+
+typedef struct{		//This struct holds the view transform as parameters, mvp is built from it
+	float translate_x, translate_y;	//Clip space units
+	float angle;					//Radians
+	float scale;
+	float shear_x, shear_y;			//x sheared along y, and y along x
+	float stretch_y;				//Extra y scale, the pixel exact presets use it to make texels square
+} ViewState;
 
 
 GLFWwindow* window;
-mat4x4 mvp;
+typedef struct{		//This struct is a 2D affine transform, the only kind the view ever makes
+	float linear[4];	//Columns (a, b) and (c, d): x' = a x + c y + e, y' = b x + d y + f
+	float offset[2];	//(e, f)
+} Affine;
+
+mat4x4 mvp;		//Rebuilt from view by update_mvp(), never edited directly, only for shader uniforms
+Affine view_transform;	//The same transform, rebuilt with mvp, for everything on the CPU side
+ViewState view = {0, 0, 0, 1, 0, 0, 1};
+int view_dirty = 1;	//view changed since mvp was built
 int width, height;
-int line = 1;
+THREAD_LOCAL int line = 1;	//Line of the file being decoded on this thread, for error messages
+int needs_redraw = 1;	//Set whenever the next frame would differ from what is on screen
+int animating = 0;		//Number of animations or loads in progress, the render loop polls while nonzero
+double input_time = 0;	//When the oldest input not yet drawn arrived, 0 if none
+double input_now = 0;	//Time of the input being handled, the recorded time while replaying
+int show_overlay = 0;	//Draw frame metrics over the image (F1 or --overlay)
+FILE* metrics_file = NULL;	//Per frame metrics CSV (--metrics)
+int acceleration = 0;	//Held key speed curve, 0 constant, 1 linear, 2 quadratic (--acceleration)
+char* headless_output = NULL;	//Render offscreen to this PPM instead of opening a window (--headless)
+int headless_frames = 60;		//Frames to time in headless mode (--frames)
+char* software_output = NULL;	//Render on the CPU to this PPM, no GL at all (--software)
+int thread_count = 0;			//Worker threads for CPU work, 0 for one per processor (--threads)
+char* batch_output = NULL;		//Transform on the CPU at image size and write this PPM (--out)
+size_t batch_memory = 512 * 1024 * 1024;	//Bytes of images in flight during directory batches (--memory)
+int resample_filter = FILTER_BILINEAR;	//Filter for viewing, software rendering and batches (--filter, F key)
+size_t texture_budget = 256 * 1024 * 1024;	//Bytes of texture memory new_texture() may use (--texture-budget)
+int watch_enabled = 0;			//Reload the shown file when it changes on disk (--watch)
+int browse_step = 0;			//PageDown and PageUp presses the render loop has not handled yet
+int sheet_toggle = 0;			//G was pressed, or --grid given, and the render loop has not switched yet
+char* compare_output = NULL;	//Render every compare view on the GPU and CPU and write results to this CSV (--compare)
+double compare_tolerance = 0;	//Lowest PSNR in dB where the two paths still agree, 0 for the per filter defaults
+								//in FilterTolerances (--tolerance)
+int pixel_grid = 0;				//Outline texels once they are big enough (P key)
+FILE* record_file = NULL;		//Input events and loop steps are written here (--record)
+char* replay_name = NULL;		//Input events are read back from here instead of the window (--replay)
+int replay_fast = 0;			//Replay without waiting for the recorded times (--replay-speed max)
+char* benchmark_name = NULL;	//Run this microbenchmark instead of viewing (--benchmark)
+int decode_megapixels = 16;		//Largest image the decode benchmark generates (--decode-megapixels)
+int magnify_nearest = 1;		//Sample GL_NEAREST past NEAREST_MAGNIFICATION, off while --compare checks the filters
 
 typedef struct{		//This struct holds the coordinates for the object we will attach our texture to
 	float position[3];
@@ -27,14 +136,405 @@ typedef struct{		//This struct holds texture width, height, and pixel informatio
 	double height;
 } Triple;
 
+typedef struct{		//This struct remembers what new_texture() actually put on the GPU
+	Triple* full;				//Full resolution image, kept in RAM so regions can be paged in
+	GLuint texture;				//Base texture, either full resolution or a downscaled level
+	int level;					//Number of times the base texture was halved to fit the budget
+	int level_width;
+	int level_height;
+	GLuint detail_texture;		//Full resolution region paged in when zoomed past the base level
+	GLuint detail_buffer;		//Quad covering that region
+	int detail_x, detail_y;		//Region in full resolution pixels, detail_width == 0 means none
+	int detail_width, detail_height;
+	GLint texture_sampling;		//GL_LINEAR or GL_NEAREST, as last set on each texture
+	GLint detail_sampling;
+} Residency;
+
+Residency residency;
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+#else
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+#endif
+
+struct{		//This struct holds the worker threads behind parallel_for()
+	Mutex lock;
+	Condition start;		//Signalled when a new batch is posted
+	Condition done;			//Signalled when the last worker finishes a batch
+	void (*function)(void*, int);
+	void* arg;
+	volatile long next;		//Next index to hand out
+	int count;
+	int busy;				//Workers still on the current batch
+	int generation;			//Bumped for every batch
+	int threads;			//Including the calling thread, 0 until started
+} pool;
+
+typedef struct{		//This struct holds one unit of work for the stealing pool
+	void (*function)(void*, int);	//Called with arg and the index of the worker running it
+	void* arg;
+} Task;
+
+typedef struct{		//This struct holds one worker's tasks, the owner pops the bottom and thieves take the top
+	Mutex lock;
+	Task* tasks;
+	int capacity;
+	int top;
+	int bottom;
+} TaskDeque;
+
+struct{		//This struct holds the work stealing pool used for independent jobs such as batch files
+	TaskDeque* deques;		//One per worker
+	int workers;			//0 until started
+	Mutex lock;
+	Condition wake;			//Signalled when a task is queued
+	Condition idle;			//Signalled when pending reaches zero
+	volatile long queued;	//Tasks sitting in deques
+	volatile long pending;	//Tasks queued or running
+} stealer;
+
+#define RESIZE_BAND 32		//Output rows per resize_triple() work item
+
+typedef struct{		//This struct holds the taps of every output position along one axis of a resize
+	int* first;			//Taps of output i are first[i] up to first[i + 1]
+	int* index;			//Source position of each tap, clamped to the edge
+	float* weight;
+} Contributions;
+
+typedef struct{		//This struct holds one resize_triple() job, shared by the worker threads
+	Triple* source;
+	Triple* target;
+	Contributions* columns;
+	Contributions* rows;
+	int ring_size;		//Horizontally filtered source rows each band keeps
+} ResizeJob;
+
+#define SOFTWARE_TILE 64	//Square tiles handed to each thread
+
+typedef struct{		//This struct holds one software render, shared by the worker threads
+	Triple* source;
+	Triple* target;
+	float s0, t0;			//Source texel coordinate under the centre of target pixel (0, 0)
+	float ds_dx, dt_dx;		//Change per target pixel to the right
+	float ds_dy, dt_dy;		//Change per target pixel down
+	Affine to_texel;		//The same mapping, for culling whole tiles
+	int filter;
+	float widen_s, widen_t;	//Source texels per target pixel when shrinking, 1 otherwise
+	int tiles_across;
+} SoftwareJob;
+
+typedef struct{		//This struct follows one file through the directory batch pipeline
+	char* input;
+	char* output;
+	size_t reserved;		//Bytes counted against batch_memory until the file is written
+	int width, height;		//From the header, read by the feeder
+	Affine transform;		//Built by the feeder for that size, workers never touch the view globals
+	Triple* source;
+	Triple result;
+} BatchItem;
+
+struct{		//This struct holds directory batch totals and the in-flight memory gate
+	Mutex lock;
+	Condition room;			//Signalled when a finished file releases memory
+	size_t in_flight;
+	volatile long long bytes_written;
+	volatile long failed;	//Files that could not be read or written, they are skipped
+} batch;
+
+enum {MOTION_ROTATE, MOTION_SCALE, MOTION_TRANSLATE, MOTION_SHEAR, MOTION_RESET};	//Reset is only an undo step
+
+typedef struct{		//This struct describes what holding a key does, per second
+	int key;
+	int kind;
+	float x, y;		//Rate along each parameter, rotate and scale only use x
+} KeyMotion;
+
+#define HOLD_DELAY 0.2f			//Seconds a key must be held before continuous motion starts
+#define ACCELERATION_TIME 2.f	//Seconds for an acceleration curve to reach full speed
+#define ACCELERATION_GAIN 3.f	//Extra speed multiple at full acceleration
+
+const KeyMotion KeyMotions[] = {	//Held key table, replaces the old per key repeat amounts
+	{GLFW_KEY_Q, MOTION_ROTATE, -1.5f, 0},		//Radians per second
+	{GLFW_KEY_W, MOTION_ROTATE, 1.5f, 0},
+	{GLFW_KEY_A, MOTION_SCALE, -0.9f, 0},		//Log scale per second
+	{GLFW_KEY_S, MOTION_SCALE, 0.9f, 0},
+	{GLFW_KEY_UP, MOTION_TRANSLATE, 0, 1.2f},	//Screen units per second
+	{GLFW_KEY_DOWN, MOTION_TRANSLATE, 0, -1.2f},
+	{GLFW_KEY_LEFT, MOTION_TRANSLATE, -1.2f, 0},
+	{GLFW_KEY_RIGHT, MOTION_TRANSLATE, 1.2f, 0},
+	{GLFW_KEY_Z, MOTION_SHEAR, -1.2f, 0},
+	{GLFW_KEY_X, MOTION_SHEAR, 1.2f, 0},
+	{GLFW_KEY_C, MOTION_SHEAR, 0, -1.2f},
+	{GLFW_KEY_V, MOTION_SHEAR, 0, 1.2f}
+};
+
+#define HISTORY_SIZE 256		//Undo steps kept, the oldest is dropped when full
+#define HISTORY_COALESCE 0.5	//Seconds, edits of one kind closer together than this are one undo step
+
+struct{		//This struct is the undo/redo ring of view states
+	ViewState states[HISTORY_SIZE];	//Entries before cursor are undo steps, from cursor on redo steps
+	int start;				//Ring position of the oldest entry
+	int count;
+	int cursor;
+	int last_kind;			//MOTION_* of the last edit, -1 to start a new step
+	double last_time;
+} history = {{{0}}, 0, 0, 0, -1, 0};
+
+#define MAX_TRANSFORM_OPTIONS 64
+
+KeyMotion transform_options[MAX_TRANSFORM_OPTIONS];	//--rotate, --scale, --shear and --translate in command line order
+int transform_option_count = 0;
+
+typedef struct{		//This struct is one view of the compare set, made of steps like the command line transforms
+	const char* name;
+	int step_count;
+	KeyMotion steps[2];
+} CompareView;
+
+const CompareView CompareViews[] = {
+	{"identity", 0, {{0}}},
+	{"rotate", 1, {{0, MOTION_ROTATE, 30, 0}}},
+	{"shrink", 2, {{0, MOTION_SCALE, 0.35f, 0}, {0, MOTION_ROTATE, -15, 0}}},
+	{"magnify", 2, {{0, MOTION_SCALE, 3.5f, 0}, {0, MOTION_TRANSLATE, 0.4f, -0.2f}}},
+	{"shear", 2, {{0, MOTION_SHEAR, 0.3f, -0.2f}, {0, MOTION_SCALE, 0.9f, 0}}}
+};
+
+#define WATCH_INTERVAL 250	//Milliseconds between checks when polling, and the longest wait for an event
+#define WATCH_SETTLE 100	//Milliseconds a changed file must keep its size and time before it is decoded
+#define RELOAD_BAND 16		//Rows compared and uploaded together after a reload
+
+struct{		//This struct is shared between the render loop and the thread watching the shown file
+	Mutex lock;
+	char* path;				//File to watch, set by the render loop
+	int path_version;		//Bumped whenever path changes
+	Triple* reloaded;		//Fresh decode waiting for the render loop, NULL if none
+	int reloaded_version;	//path_version the decode was made for
+} watch;
+
+#define BROWSE_CACHE 8	//Decoded images kept while browsing, the current one included
+#define BROWSE_AHEAD 2	//Neighbours decoded ahead on each side of the current image
+#define BROWSE_WARM 1	//Neighbours on each side also kept uploaded as textures
+
+typedef struct{		//This struct is one image in the browse cache
+	int index;				//Position in browser.names, -1 if the slot is free
+	Triple* image;			//NULL until decoded
+	int loading;			//A worker is decoding into this slot, so it cannot be reused
+	int failed;				//The file could not be decoded, image is a placeholder
+	Residency residency;	//What new_texture() and page_detail() uploaded, texture 0 if not resident
+	long last_used;
+} CachedImage;
+
+struct{		//This struct holds the browse list and the decoded image cache shared with the prefetch workers
+	char** names;			//Paths given on the command line, or the .ppm files of a directory
+	int count;
+	int current;
+	Mutex lock;
+	Condition loaded;		//Signalled when a worker finishes a decode
+	CachedImage slots[BROWSE_CACHE];
+	long clock;				//Advanced on every use, for least recently used eviction
+} browser;
+
+#define THUMB_SIZE 128		//Longest side of a contact sheet thumbnail, in pixels
+#define THUMB_ROW_SAMPLES 2	//Source rows read per thumbnail row, the rest are skipped
+#define ATLAS_SIZE 2048		//Side of each atlas texture
+#define MAX_ATLASES 64
+#define SHEET_MARGIN 8		//Pixels around each grid cell
+#define SHEET_MAX 16384		//Thumbnails one GLushort index buffer can address
+
+typedef struct{		//This struct is one contact sheet thumbnail
+	Triple* pixels;			//Set by the worker that decoded it, freed once packed into an atlas
+	int atlas;				//-1 until packed
+	int x, y;				//Place in the atlas
+	int width, height;
+} Thumbnail;
+
+struct{		//This struct holds the contact sheet, its atlases and the batched geometry for all thumbnails
+	int active;				//Grid shown instead of the current image (G or --grid)
+	Thumbnail* thumbs;		//One per browse list entry, NULL until the sheet is first shown
+	int count;				//Browse list entries on the sheet, at most SHEET_MAX
+	Mutex lock;
+	GLuint atlases[MAX_ATLASES];
+	int atlas_count;
+	int shelf_x, shelf_y;	//Next free spot on the open shelf of the newest atlas
+	int shelf_height;
+	GLuint vertex_buffer, index_buffer;
+	int index_counts[MAX_ATLASES];	//Indices per atlas, stored one atlas after another
+	int layout_width;		//Window width the geometry was laid out for, 0 to force a rebuild
+	ViewState view;			//Pan and zoom of the sheet, swapped with the image view on entering and leaving
+} sheet;
+
+#define THUMB_DB_VERSION 2	//2 keys records by absolute path
+#define THUMB_DB_PATH 512	//Longest absolute path a record holds, longer paths are never cached
+#define THUMB_DB_BYTES (THUMB_SIZE * THUMB_SIZE * 3)	//Fixed pixel slot per record
+
+typedef struct{		//This struct starts the thumbnail database file, the index, records and pixel slots follow
+	char magic[8];				//"EZTHUMBS"
+	uint32_t version;
+	uint32_t thumb_size;		//THUMB_SIZE the file was written with
+	uint32_t index_capacity;	//Power of two, at least twice record_capacity
+	uint32_t record_capacity;
+	volatile uint32_t record_count;
+	uint32_t reserved;
+} ThumbDbHeader;
+
+typedef struct{		//This struct is one open addressed index slot
+	uint64_t hash;
+	volatile uint32_t record;	//Record number plus one, 0 while empty, written after everything else
+	uint32_t reserved;
+} ThumbDbSlot;
+
+typedef struct{		//This struct describes one cached thumbnail
+	volatile uint32_t sequence;	//Odd while a writer is changing the record or its pixels
+	uint16_t width, height;
+	int64_t mtime;				//Source file state the thumbnail was made from
+	int64_t size;
+	uint64_t hash;
+	char path[THUMB_DB_PATH];
+} ThumbDbRecord;
+
+typedef struct{		//This struct is a file mapped into memory
+	unsigned char* base;	//NULL if nothing is mapped
+	size_t size;
+#ifdef _WIN32
+	HANDLE file, mapping;
+#else
+	int file;
+#endif
+} MappedFile;
+
+struct{		//This struct holds the open thumbnail database, readers use it without taking any lock
+	char* path;				//--thumb-db, or a file in the browsed directory
+	MappedFile map;
+	ThumbDbHeader* header;
+	ThumbDbSlot* index;
+	ThumbDbRecord* records;
+	GLubyte* pixels;		//THUMB_DB_BYTES per record
+	Mutex write_lock;		//Writers in this process take turns, readers retry if a record changes under them
+	volatile long hits, misses;
+} thumb_db;
+
+const int GeneratedSizes[][2] = {{1920, 1080}, {3001, 2003}};	//Synthetic images compared after the files, the odd
+																//size catches row padding mistakes
+
+#define KEY_MOTION_COUNT (sizeof(KeyMotions) / sizeof(KeyMotion))
+double hold_start[KEY_MOTION_COUNT];	//When each motion key went down, 0 if up
+double last_motion_time = 0;			//Time of the previous motion update, 0 when nothing is held
+
+#define WHEEL_ZOOM 1.1f			//Scale multiple per scroll wheel notch
+#define INERTIA_FRICTION 4.f	//Per second decay rate of a flung pan
+#define INERTIA_STOP 0.02f		//Screen units per second below which a fling stops
+#define FLING_WINDOW 0.05		//Seconds, a drag released after resting this long does not coast
+
+struct{		//This struct follows the mouse for drag panning
+	int dragging;
+	int coasting;			//Panning on after release, counted in animating
+	double x, y;			//Last cursor position, window coordinates
+	double last_move;		//Time of the last drag movement
+	double last_coast;		//Time of the previous inertia update
+	float velocity_x, velocity_y;	//Screen units per second
+} pointer;
+
+#define REPLAY_EPOCH 1.0		//Clock at the start of a replay, nonzero because 0 marks unset times
+
+struct{		//This struct is the state of --record and --replay
+	double record_start;		//Clock when recording began, logged times are relative to it
+	FILE* file;					//Log being replayed, NULL when the window supplies input
+	double start;				//Real time the replay began
+	char keys[GLFW_KEY_LAST + 1];	//Keys down in the replayed session, for update_motion()
+	double cursor_x, cursor_y;
+	long events, steps;
+} replay;
+
+#define MAX_CACHED_MATRICES 8
+
+typedef struct{		//This struct mirrors the GL state ezview sets, so redundant calls can be skipped
+	GLfloat clear_color[4];
+	int clear_color_set;
+	GLint viewport[4];
+	GLuint program;
+	GLuint array_buffer;
+	GLuint element_buffer;
+	GLuint attribute_buffer;	//Buffer the vertex attribute pointers were last set from
+	GLuint texture;				//Texture bound to GL_TEXTURE_2D
+	struct{
+		GLuint program;
+		GLint location;
+		GLfloat value[16];
+	} matrices[MAX_CACHED_MATRICES];	//Last value of each mat4 uniform
+	int matrix_count;
+	int calls_issued;			//Calls that reached GL this frame
+	int calls_skipped;			//Calls dropped as redundant this frame
+} GLState;
+
+GLState gl_state;
+
 typedef struct{		//This struct holds shader variables for future use
+	GLint program_id;
 	GLint position_slot;
 	GLint color_slot;
 	GLint texture_slot;
 	GLint mvp_slot;
 	GLint textureUniform;
+	GLint texture_size_slot;	//-1 unless the program filters in the shader
+	GLint grid_width_slot;		//-1 unless the program draws the pixel grid
 } VariableArray;
 
+enum {ATTRIBUTE_POSITION, ATTRIBUTE_COLOR, ATTRIBUTE_TEXCOORD};	//Bound in simple_program()
+
+#define KERNEL_RESOLUTION 256	//Samples per texel in kernel_table
+#define MAX_FILTER_TAPS 64		//Per axis, bounds how far filters widen when shrinking
+
+float kernel_table[FILTER_COUNT][3 * KERNEL_RESOLUTION + 2];	//filter_kernel() sampled from 0 to its support
+
+VariableArray* filter_variables[FILTER_COUNT];	//Built on first use by use_filter()
+VariableArray* grid_variables = NULL;			//Built on first use by use_grid()
+
+#define NEAREST_MAGNIFICATION 2.f	//Screen pixels per texel from which textures are sampled GL_NEAREST
+#define GRID_MAGNIFICATION 8.f		//Screen pixels per texel from which the pixel grid is drawn
+
+#define FRAME_HISTORY 64	//Frames kept for the overlay average, must exceed QUERY_COUNT
+#define QUERY_COUNT 4		//GPU timer queries in flight
+
+typedef struct{		//This struct holds timings for one frame, in milliseconds
+	double cpu;			//From the start of the frame until swap
+	double swap;		//Time spent in glfwSwapBuffers
+	double latency;		//From the oldest waiting input until the frame was presented, -1 if none
+	double gpu;			//GPU time from GL_EXT_disjoint_timer_query, -1 if unknown
+	int gl_calls;		//State and draw calls issued, see GLState
+	int gl_skipped;		//Redundant state calls the cache dropped
+} FrameMetrics;
+
+FrameMetrics frame_history[FRAME_HISTORY];
+long frame_count = 0;		//Frames finished
+long gpu_pending = 0;		//Oldest frame whose GPU time has not been collected
+double frame_start;
+int gpu_timer = 0;			//Set if the timer query extension is usable
+GLuint gpu_queries[QUERY_COUNT];
+PFNGLGENQUERIESEXTPROC glGenQueriesEXT_;
+PFNGLBEGINQUERYEXTPROC glBeginQueryEXT_;
+PFNGLENDQUERYEXTPROC glEndQueryEXT_;
+PFNGLGETQUERYOBJECTUIVEXTPROC glGetQueryObjectuivEXT_;
+PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT_;
+
+#define OVERLAY_COLUMNS 16
+#define OVERLAY_LINES 6
+#define OVERLAY_WIDTH (OVERLAY_COLUMNS * 4 + 1)	//Glyphs are 3x5 pixels in a 4x6 cell
+#define OVERLAY_HEIGHT (OVERLAY_LINES * 6 + 1)
+#define OVERLAY_SCALE 3
+GLuint overlay_texture = 0;
+GLuint overlay_buffer = 0;
+GLuint quad_index_buffer = 0;	//Indices shared by every single quad, from bind_buffer()
+
+const char font_chars[] = "-./0123456789:ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+const unsigned short font_glyphs[] = {	//3x5 bitmaps for font_chars, top left pixel in bit 14
+	0x01c0, 0x0002, 0x12a4, 0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef, 0x7249, 0x7bef, 0x7bcf, 0x0410,
+	0x7bed, 0x6bae, 0x7927, 0x6b6e, 0x79e7, 0x79e4, 0x796f, 0x5bed, 0x7497, 0x126f, 0x5bad, 0x4927, 0x5f6d, 0x7b6d,
+	0x7b6f, 0x7be4, 0x7b79, 0x7bad, 0x79cf, 0x7492, 0x5b6f, 0x5b6a, 0x5b7d, 0x5aad, 0x5a92, 0x72a7
+};
+
 const Vertex Vertices[] = {	//This array holds our object coordinates, color, and texture coordinates
   {{-1, 1, 0}, {1, 1, 1, 0}, {0, 0}},
   {{1, 1, 0}, {1, 1, 1, 0}, {1, 0}},
@@ -74,100 +574,279 @@ char* fragment_shader_src =		//This is our fragment shader info
   "}\n";
 
 
-GLint simple_shader(GLint shader_type, char* shader_src) {	//Create simple shader, error check
+//GL state cache -----------------------------
 
-  GLint compile_success = 0;
+void note_gl_call(){	//Count a GL call that is always issued, such as a clear or draw
+	gl_state.calls_issued++;
+}
 
-  int shader_id = glCreateShader(shader_type);	//Create shader
+int state_unchanged(int same){	//Count a cached call as skipped or issued
+	if(same){
+		gl_state.calls_skipped++;
+		return 1;
+	}
+	gl_state.calls_issued++;
+	return 0;
+}
 
-  glShaderSource(shader_id, 1, &shader_src, 0);	//Add information from earlier into shader
+void cached_clear_color(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha){
+	GLfloat color[4] = {red, green, blue, alpha};
+	if(state_unchanged(gl_state.clear_color_set && memcmp(color, gl_state.clear_color, sizeof(color)) == 0)) return;
+	memcpy(gl_state.clear_color, color, sizeof(color));
+	gl_state.clear_color_set = 1;
+	glClearColor(red, green, blue, alpha);
+}
 
-  glCompileShader(shader_id);	//Compile shader
+void cached_viewport(GLint x, GLint y, GLsizei view_width, GLsizei view_height){
+	GLint viewport[4] = {x, y, view_width, view_height};
+	if(state_unchanged(memcmp(viewport, gl_state.viewport, sizeof(viewport)) == 0)) return;
+	memcpy(gl_state.viewport, viewport, sizeof(viewport));
+	glViewport(x, y, view_width, view_height);
+}
 
-  glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compile_success);	//See if the shader was compiled
+void cached_use_program(GLuint program){
+	if(state_unchanged(gl_state.program == program)) return;
+	gl_state.program = program;
+	glUseProgram(program);
+}
 
-  if (compile_success == GL_FALSE) {
-    GLchar message[256];
-    glGetShaderInfoLog(shader_id, sizeof(message), 0, &message[0]);
-    printf("glCompileShader Error: %s\n", message);
-    exit(1);
-  }
+void cached_bind_buffer(GLenum target, GLuint buffer){
+	GLuint* bound = target == GL_ARRAY_BUFFER ? &gl_state.array_buffer : &gl_state.element_buffer;
+	if(state_unchanged(*bound == buffer)) return;
+	*bound = buffer;
+	glBindBuffer(target, buffer);
+}
 
-  return shader_id;
+void cached_bind_texture(GLuint texture){	//Bind to GL_TEXTURE_2D on the active unit, ezview only uses unit 0
+	if(state_unchanged(gl_state.texture == texture)) return;
+	gl_state.texture = texture;
+	glBindTexture(GL_TEXTURE_2D, texture);
 }
 
+void cached_uniform_matrix(GLint location, const GLfloat* matrix){	//Upload a mat4 uniform unless it already holds matrix
+	int i;
+	for(i = 0; i < gl_state.matrix_count; i++)
+		if(gl_state.matrices[i].program == gl_state.program && gl_state.matrices[i].location == location)
+			break;
+	if(i < gl_state.matrix_count && state_unchanged(memcmp(gl_state.matrices[i].value, matrix, 16 * sizeof(GLfloat)) == 0))
+		return;
+	if(i == gl_state.matrix_count){
+		if(i == MAX_CACHED_MATRICES){	//Table is full, forget everything rather than grow it
+			gl_state.matrix_count = i = 0;
+		}
+		gl_state.matrix_count++;
+		gl_state.calls_issued++;
+	}
+	gl_state.matrices[i].program = gl_state.program;
+	gl_state.matrices[i].location = location;
+	memcpy(gl_state.matrices[i].value, matrix, 16 * sizeof(GLfloat));
+	glUniformMatrix4fv(location, 1, GL_FALSE, matrix);
+}
 
-int simple_program() {	//Create simple program for OpenGL to use
+void forget_texture(GLuint texture){	//Call before deleting a texture so a recycled name is not mistaken for it
+	if(gl_state.texture == texture)
+		gl_state.texture = 0;
+}
 
-  GLint link_success = 0;
+void forget_buffer(GLuint buffer){	//Call before deleting a buffer
+	if(gl_state.array_buffer == buffer)
+		gl_state.array_buffer = 0;
+	if(gl_state.element_buffer == buffer)
+		gl_state.element_buffer = 0;
+	if(gl_state.attribute_buffer == buffer)
+		gl_state.attribute_buffer = 0;
+}
+//-------------------------------------
 
-  GLint program_id = glCreateProgram();	//Create program
-  //Create shaders
-  GLint vertex_shader = simple_shader(GL_VERTEX_SHADER, vertex_shader_src);
-  GLint fragment_shader = simple_shader(GL_FRAGMENT_SHADER, fragment_shader_src);
-  
-  //Attach shaders
-  glAttachShader(program_id, vertex_shader);
-  glAttachShader(program_id, fragment_shader);
+char* filtered_fragment_src =	//Fragment shader for the bicubic and Lanczos filters, FILTER_RADIUS and
+								//LANCZOS are prepended, see filter_kernel() for the CPU side
+  "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+  "precision highp float;\n"	//Texel positions of big images need the precision
+  "#else\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "varying vec2 TexCoordOut;\n"
+  "uniform sampler2D Texture;\n"
+  "uniform vec2 TextureSize;\n"
+  "\n"
+  "float kernel(float x) {\n"
+  "    x = abs(x);\n"
+  "#if LANCZOS\n"
+  "    if (x < 0.00001) return 1.0;\n"
+  "    if (x >= 3.0) return 0.0;\n"
+  "    float px = 3.14159265 * x;\n"
+  "    return 3.0 * sin(px) * sin(px / 3.0) / (px * px);\n"
+  "#else\n"
+  "    if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;\n"	//Catmull-Rom
+  "    if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;\n"
+  "    return 0.0;\n"
+  "#endif\n"
+  "}\n"
+  "\n"
+  "void main(void) {\n"
+  "    vec2 position = TexCoordOut * TextureSize - 0.5;\n"	//Texel space, centres on integers
+  "    vec2 base = floor(position);\n"
+  "    vec2 f = position - base;\n"
+  "    vec4 sum = vec4(0.0);\n"
+  "    float total = 0.0;\n"
+  "    for (int j = 1 - FILTER_RADIUS; j <= FILTER_RADIUS; j++) {\n"
+  "        float wy = kernel(float(j) - f.y);\n"
+  "        for (int i = 1 - FILTER_RADIUS; i <= FILTER_RADIUS; i++) {\n"
+  "            float w = kernel(float(i) - f.x) * wy;\n"	//Sampled with GL_NEAREST, so texel centres read back exactly
+  "            sum += w * texture2D(Texture, (base + vec2(float(i), float(j)) + 0.5) / TextureSize);\n"
+  "            total += w;\n"
+  "        }\n"
+  "    }\n"
+  "    gl_FragColor = sum / total;\n"
+  "}\n";
 
-  glLinkProgram(program_id);	//Link program
+char* grid_fragment_src =	//Fragment shader for magnified GL_NEAREST textures with the texel edges outlined
+  "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+  "precision highp float;\n"
+  "#else\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "varying vec2 TexCoordOut;\n"
+  "uniform sampler2D Texture;\n"
+  "uniform vec2 TextureSize;\n"
+  "uniform float GridWidth;\n"	//Texels per screen pixel, so lines are one pixel wide
+  "\n"
+  "void main(void) {\n"
+  "    vec2 edge = fract(TexCoordOut * TextureSize);\n"
+  "    vec4 color = texture2D(Texture, TexCoordOut);\n"
+  "    if (min(edge.x, edge.y) < GridWidth)\n"	//Lighten dark texels and darken light ones
+  "        color.rgb = mix(color.rgb, vec3(step(dot(color.rgb, vec3(0.299, 0.587, 0.114)), 0.5)), 0.5);\n"
+  "    gl_FragColor = color;\n"
+  "}\n";
 
-  glGetProgramiv(program_id, GL_LINK_STATUS, &link_success);	//See if program link was successful
 
-  if (link_success == GL_FALSE) {
-    GLchar message[256];
-    glGetProgramInfoLog(program_id, sizeof(message), 0, &message[0]);
-    printf("glLinkProgram Error: %s\n", message);
-    exit(1);
-  }
+//Affine transforms -----------------------------
 
-  return program_id;
+void affine_compose(Affine* out, const Affine* first, const Affine* second){	//out = first * second, second applies
+																				//first, out may be either
+#ifdef USE_SSE2
+	__m128 left = _mm_loadu_ps(first->linear);
+	__m128 column_0 = _mm_movelh_ps(left, left);	//a b a b
+	__m128 column_1 = _mm_movehl_ps(left, left);	//c d c d
+	__m128 right = _mm_loadu_ps(second->linear);
+	__m128 offset = _mm_add_ps(_mm_add_ps(_mm_mul_ps(column_0, _mm_set1_ps(second->offset[0])),
+										_mm_mul_ps(column_1, _mm_set1_ps(second->offset[1]))),
+								_mm_set_ps(0, 0, first->offset[1], first->offset[0]));
+	__m128 linear = _mm_add_ps(_mm_mul_ps(column_0, _mm_shuffle_ps(right, right, _MM_SHUFFLE(2, 2, 0, 0))),
+								_mm_mul_ps(column_1, _mm_shuffle_ps(right, right, _MM_SHUFFLE(3, 3, 1, 1))));
+	_mm_storeu_ps(out->linear, linear);
+	_mm_storel_pi((__m64*) out->offset, offset);
+#else
+	const float* a = first->linear;
+	const float* b = second->linear;
+	Affine result;
+	result.linear[0] = a[0] * b[0] + a[2] * b[1];
+	result.linear[1] = a[1] * b[0] + a[3] * b[1];
+	result.linear[2] = a[0] * b[2] + a[2] * b[3];
+	result.linear[3] = a[1] * b[2] + a[3] * b[3];
+	result.offset[0] = a[0] * second->offset[0] + a[2] * second->offset[1] + first->offset[0];
+	result.offset[1] = a[1] * second->offset[0] + a[3] * second->offset[1] + first->offset[1];
+	*out = result;
+#endif
 }
 
-void rotate_matrix(float add_angle){	//Add rotation properties to our transformation matrix (mvp)
-	
-	float ratio = width/ (float) height;
-	mat4x4 rotate_matrix = 
-	{
-		{cosf(add_angle), -ratio * sinf(add_angle), 0, 0},
-		{1/ratio * sinf(add_angle), cosf(add_angle), 0, 0},
-		{0, 0, 1, 0},
-		{0, 0, 0, 1}
-	};
-	
-	mat4x4_mul(mvp, mvp, rotate_matrix);	//Multiply tranformation matrix to rotation matrix to apply properties
+void affine_invert(Affine* out, const Affine* transform){	//out may be transform
+	const float* m = transform->linear;
+	float inverse_determinant = 1 / (m[0] * m[3] - m[1] * m[2]);
+#ifdef USE_SSE2
+	__m128 linear = _mm_loadu_ps(m);
+	__m128 column_0, column_1, offset;
+	linear = _mm_mul_ps(_mm_shuffle_ps(linear, linear, _MM_SHUFFLE(0, 2, 1, 3)),	//d b c a
+						_mm_set_ps(inverse_determinant, -inverse_determinant, -inverse_determinant, inverse_determinant));
+	column_0 = _mm_movelh_ps(linear, linear);
+	column_1 = _mm_movehl_ps(linear, linear);
+	offset = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_mul_ps(column_0, _mm_set1_ps(transform->offset[0])),
+													_mm_mul_ps(column_1, _mm_set1_ps(transform->offset[1]))));
+	_mm_storeu_ps(out->linear, linear);
+	_mm_storel_pi((__m64*) out->offset, offset);
+#else
+	Affine result;
+	result.linear[0] = m[3] * inverse_determinant;
+	result.linear[1] = -m[1] * inverse_determinant;
+	result.linear[2] = -m[2] * inverse_determinant;
+	result.linear[3] = m[0] * inverse_determinant;
+	result.offset[0] = -(result.linear[0] * transform->offset[0] + result.linear[2] * transform->offset[1]);
+	result.offset[1] = -(result.linear[1] * transform->offset[0] + result.linear[3] * transform->offset[1]);
+	*out = result;
+#endif
 }
 
-void scale_matrix(float scale_index){	//Add scaling property to our tranformation matrix (mvp)
-	mat4x4 scale_matrix = {	//Our scaling matrix
-		{scale_index, 0.f, 0.f, 0.f},
-		{0.f,   scale_index,   0.f, 0.f},
-		{0.f,  0.f,   1.f, 0.f},
-		{0.f, 0.f, 0.f, 1.f}
-	};
-	mat4x4_mul(mvp, mvp, scale_matrix);	//Multiply tranformation matrix to apply scaling locally
+void affine_apply(const Affine* transform, float x, float y, float* out){	//Map one point, out gets x and y
+#ifdef USE_SSE2
+	__m128 linear = _mm_loadu_ps(transform->linear);
+	__m128 point = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_movelh_ps(linear, linear), _mm_set1_ps(x)),
+										_mm_mul_ps(_mm_movehl_ps(linear, linear), _mm_set1_ps(y))),
+								_mm_set_ps(0, 0, transform->offset[1], transform->offset[0]));
+	_mm_storel_pi((__m64*) out, point);
+#else
+	const float* m = transform->linear;
+	out[0] = m[0] * x + m[2] * y + transform->offset[0];
+	out[1] = m[1] * x + m[3] * y + transform->offset[1];
+#endif
+}
+
+void affine_apply_many(const Affine* transform, const float* points, float* out, int count){	//Map count x, y pairs,
+	int i = 0;																				//out may be points
+#ifdef USE_SSE2
+	__m128 linear = _mm_loadu_ps(transform->linear);
+	__m128 column_0 = _mm_movelh_ps(linear, linear);
+	__m128 column_1 = _mm_movehl_ps(linear, linear);
+	__m128 offset = _mm_set_ps(transform->offset[1], transform->offset[0], transform->offset[1], transform->offset[0]);
+	for(; i + 2 <= count; i += 2){	//Two points per register
+		__m128 pair = _mm_loadu_ps(points + 2 * i);
+		__m128 xs = _mm_shuffle_ps(pair, pair, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 ys = _mm_shuffle_ps(pair, pair, _MM_SHUFFLE(3, 3, 1, 1));
+		_mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(column_0, xs), _mm_mul_ps(column_1, ys)), offset));
+	}
+#endif
+	for(; i < count; i++)
+		affine_apply(transform, points[2 * i], points[2 * i + 1], out + 2 * i);
+}
+
+void affine_to_mat4x4(mat4x4 out, const Affine* transform){	//For shader uniforms, z and w pass through
+	mat4x4_identity(out);
+	out[0][0] = transform->linear[0];
+	out[0][1] = transform->linear[1];
+	out[1][0] = transform->linear[2];
+	out[1][1] = transform->linear[3];
+	out[3][0] = transform->offset[0];
+	out[3][1] = transform->offset[1];
+}
+//-------------------------------------
+
+void rotate_matrix(float add_angle){	//Add to the rotation of the view
+	view.angle += add_angle;
+	view_dirty = 1;
+	needs_redraw = 1;
+}
+
+void scale_matrix(float scale_index){	//Multiply the scale of the view
+	view.scale *= scale_index;
+	view_dirty = 1;
+	needs_redraw = 1;
 }
 
-void translate_matrix(float x, float y){	//Add translation property to our tranformation matrix (mvp)
+void translate_matrix(float x, float y){	//Add to the translation of the view, in screen units
 	float ratio;
-	if(width > height){
+	if(width > height){	//Same distance on screen along either axis
 		ratio = width/ (float) height;
 		x = x/ratio;
 	}else if(height > width){
 		ratio = height/ (float) width;
 		y = y/ratio;
 	}
-	mat4x4 translate_matrix = {	//Our translation matrix
-		{1.f, 0.f, 0.f, 0.f},
-		{0.f, 1.f, 0.f, 0.f},
-		{0.f, 0.f, 1.f, 0.f},
-		{x, y, 0.f, 1.f}
-	};
-	mat4x4_mul(mvp, translate_matrix, mvp);	//Multiply our translation matrix to transformation matrix to apply
-											//properties globally
+	view.translate_x += x;
+	view.translate_y += y;
+	view_dirty = 1;
+	needs_redraw = 1;
 }
 
-void shear_matrix(float change_xy, float change_yx){	//Add shear property to our transformation matrix (mvp)
+void shear_matrix(float change_xy, float change_yx){	//Add to the shear of the view
 	float ratio;
 	if(width > height){
 		ratio = width/ (float) height;
@@ -176,78 +855,464 @@ void shear_matrix(float change_xy, float change_yx){	//Add shear property to our
 		ratio = height/ (float) width;
 		change_yx = change_yx/ratio;
 	}
-	mat4x4 shear_matrix = {	//Our shear matrix
-		{1.f, change_yx, 0.f, 0.f},
-		{change_xy, 1.f, 0.f, 0.f},
-		{0.f, 0.f, 1.f, 0.f},
-		{0.f, 0.f, 0.f, 1.f}
-	};
-	mat4x4_mul(mvp, mvp, shear_matrix);	//Multiply tranform. matrix to shear matrix to apply properties locally
+	view.shear_x += change_xy;
+	view.shear_y += change_yx;
+	view_dirty = 1;
+	needs_redraw = 1;
+}
+
+void reset_view(){	//Back to the untransformed image, exactly
+	view.translate_x = view.translate_y = 0;
+	view.angle = 0;
+	view.scale = 1;
+	view.shear_x = view.shear_y = 0;
+	view.stretch_y = 1;
+	view_dirty = 1;
+	needs_redraw = 1;
+}
+
+void update_mvp(){	//Rebuild view_transform and mvp from the view parameters, call before anything reads them
+	float ratio = width/ (float) height;
+	float c = cosf(view.angle), s = sinf(view.angle);
+	Affine rotate_transform = {{c, -ratio * s, 1/ratio * s, c}, {0, 0}};	//Rotates screen pixels, not clip space, so
+																			//the image keeps its shape
+	Affine scale_transform = {{view.scale, 0, 0, view.scale * view.stretch_y}, {0, 0}};
+	Affine shear_transform = {{1, view.shear_y, view.shear_x, 1}, {0, 0}};
+	if(!view_dirty) return;
+	affine_compose(&view_transform, &rotate_transform, &scale_transform);	//translate * rotate * scale * shear
+	affine_compose(&view_transform, &view_transform, &shear_transform);
+	view_transform.offset[0] = view.translate_x;	//Nothing else moves the origin
+	view_transform.offset[1] = view.translate_y;
+	affine_to_mat4x4(mvp, &view_transform);
+	view_dirty = 0;
+}
+
+void image_size(int* image_width, int* image_height){	//Full resolution size of the shown image
+	if(residency.level > 0 && residency.full != NULL){
+		*image_width = residency.full->width;
+		*image_height = residency.full->height;
+	}else{
+		*image_width = residency.level_width;
+		*image_height = residency.level_height;
+	}
+}
+
+void zoom_preset(int pixels){	//Show each image pixel as pixels by pixels screen pixels, 0 fits the window
+	Affine inverse;
+	float object[2] = {0, 0};
+	int image_width, image_height;
+	float pixel_scale, scale_x, scale_y, left, bottom;
+	image_size(&image_width, &image_height);
+	if(pixels > 0){
+		pixel_scale = pixels;
+		update_mvp();
+		affine_invert(&inverse, &view_transform);
+		affine_apply(&inverse, 0, 0, object);	//Keep the image point in the middle of the window there
+	}else
+		pixel_scale = fminf(width / (float) image_width, height / (float) image_height);
+	scale_x = pixel_scale * image_width / width;	//The quad is 2 units wide, the window 2 units and width pixels
+	scale_y = pixel_scale * image_height / height;
+	left = roundf((1 - scale_x * (object[0] + 1)) * width / 2);	//Snap the image corner to a pixel corner, so texel
+	bottom = roundf((1 - scale_y * (object[1] + 1)) * height / 2);	//edges land on pixel edges
+	view.translate_x = left * 2 / width - 1 + scale_x;
+	view.translate_y = bottom * 2 / height - 1 + scale_y;
+	view.angle = 0;
+	view.scale = scale_x;
+	view.stretch_y = scale_y / scale_x;
+	view.shear_x = view.shear_y = 0;
+	view_dirty = 1;
+	needs_redraw = 1;
 }
 
 static void error_callback(int error, const char* description) {	//Print errors that occur
   fputs(description, stderr);
 }
 
+double now_seconds(){	//Monotonic time in seconds, usable before glfwInit and from any thread
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if(frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double) counter.QuadPart / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+void mark_input(){	//Remember when the oldest input not yet on screen arrived
+	if(input_time == 0)
+		input_time = now_seconds();
+}
+
+void stamp_input(){	//Take the time of an input from the clock, unless a replay already set it
+	if(replay.file == NULL)
+		input_now = now_seconds();
+}
+
+void record_event(char type, const char* format, ...){	//Append one input event to the --record log
+	va_list arguments;
+	if(record_file == NULL) return;
+	fprintf(record_file, "%c %.6f", type, input_now - replay.record_start);
+	va_start(arguments, format);
+	vfprintf(record_file, format, arguments);
+	va_end(arguments);
+	fputc('\n', record_file);
+}
+
+int key_held(int key){	//glfwGetKey() for the window or the replayed session
+	if(replay.file != NULL)
+		return replay.keys[key];
+	return glfwGetKey(window, key) == GLFW_PRESS;
+}
+
+void cursor_position(double* x, double* y){	//glfwGetCursorPos() for the window or the replayed session
+	if(replay.file != NULL){
+		*x = replay.cursor_x;
+		*y = replay.cursor_y;
+	}else
+		glfwGetCursorPos(window, x, y);
+}
+
+void request_redraw(){	//Mark the window damaged and wake the render loop, safe to call from other threads
+	needs_redraw = 1;
+	glfwPostEmptyEvent();
+}
+
+void stop_coasting(){
+	if(pointer.coasting){
+		pointer.coasting = 0;
+		animating--;
+	}
+}
+
+ViewState* history_entry(int i){	//Entry i of the ring, 0 is the oldest
+	return &history.states[(history.start + i) % HISTORY_SIZE];
+}
+
+void note_edit(int kind){	//Save the view before an interactive edit, a run of one kind shares the step
+	double now = input_now;
+	if(kind == history.last_kind && now - history.last_time < HISTORY_COALESCE){	//Held key or quick taps
+		history.last_time = now;
+		return;
+	}
+	history.last_kind = kind;
+	history.last_time = now;
+	history.count = history.cursor;	//A new edit drops the redo steps
+	if(history.count == HISTORY_SIZE){
+		history.start = (history.start + 1) % HISTORY_SIZE;
+		history.count--;
+	}
+	*history_entry(history.count++) = view;
+	history.cursor = history.count;
+}
+
+void step_history(int direction){	//Undo (-1) or redo (1), swapping the view with the saved one so it can come back
+	ViewState saved;
+	int i;
+	if(direction < 0 ? history.cursor == 0 : history.cursor == history.count) return;
+	stop_coasting();
+	i = direction < 0 ? history.cursor - 1 : history.cursor;
+	saved = *history_entry(i);
+	*history_entry(i) = view;
+	view = saved;
+	history.cursor += direction;
+	history.last_kind = -1;	//The next edit is a step of its own
+	view_dirty = 1;
+	needs_redraw = 1;
+}
+
+void clear_history(){
+	history.count = history.cursor = 0;
+	history.last_kind = -1;
+}
+
+void window_to_screen(double x, double y, float* screen_x, float* screen_y){	//Window coordinates to -1..1, y up
+	int window_width, window_height;
+	glfwGetWindowSize(window, &window_width, &window_height);
+	*screen_x = window_width > 0 ? 2 * x / window_width - 1 : 0;
+	*screen_y = window_height > 0 ? 1 - 2 * y / window_height : 0;
+}
+
+static void scroll_callback(GLFWwindow* window, double x_offset, double y_offset){	//Zoom about the cursor
+	Affine inverse;
+	float screen[2], image[2], moved[2];
+	double x, y;
+	if(y_offset == 0) return;
+	stamp_input();
+	cursor_position(&x, &y);
+	record_event('S', " %g %g %.2f %.2f", x_offset, y_offset, x, y);
+	mark_input();
+	stop_coasting();
+	window_to_screen(x, y, &screen[0], &screen[1]);
+	update_mvp();
+	affine_invert(&inverse, &view_transform);
+	affine_apply(&inverse, screen[0], screen[1], image);	//Image point under the cursor
+	note_edit(MOTION_SCALE);
+	scale_matrix(powf(WHEEL_ZOOM, y_offset));
+	update_mvp();
+	affine_apply(&view_transform, image[0], image[1], moved);	//Where the zoom moved it to, put it back
+	view.translate_x += screen[0] - moved[0];
+	view.translate_y += screen[1] - moved[1];
+	view_dirty = 1;
+}
+
+static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods){	//Drag to pan
+	if(button != GLFW_MOUSE_BUTTON_LEFT) return;
+	stamp_input();
+	cursor_position(&pointer.x, &pointer.y);
+	record_event('B', " %d %d %d %.2f %.2f", button, action, mods, pointer.x, pointer.y);
+	if(action == GLFW_PRESS){
+		stop_coasting();	//Grabbing the image stops a fling
+		pointer.dragging = 1;
+		pointer.velocity_x = pointer.velocity_y = 0;
+		pointer.last_move = input_now;
+		history.last_kind = -1;	//Each drag is its own undo step
+		note_edit(MOTION_TRANSLATE);
+	}else if(action == GLFW_RELEASE && pointer.dragging){
+		double now = input_now;
+		pointer.dragging = 0;
+		if(now - pointer.last_move < FLING_WINDOW &&
+			fabsf(pointer.velocity_x) + fabsf(pointer.velocity_y) > INERTIA_STOP){	//Still moving, let it coast
+			pointer.coasting = 1;
+			pointer.last_coast = now;
+			animating++;
+		}
+	}
+}
+
+static void cursor_position_callback(GLFWwindow* window, double x, double y){	//Pan while dragging, applied at once
+	float from_x, from_y, to_x, to_y;
+	double now, dt;
+	if(!pointer.dragging) return;
+	stamp_input();
+	record_event('C', " %.2f %.2f", x, y);
+	mark_input();
+	window_to_screen(pointer.x, pointer.y, &from_x, &from_y);
+	window_to_screen(x, y, &to_x, &to_y);
+	pointer.x = x;
+	pointer.y = y;
+	view.translate_x += to_x - from_x;	//Image follows the cursor exactly
+	view.translate_y += to_y - from_y;
+	view_dirty = 1;
+	needs_redraw = 1;
+	now = input_now;
+	dt = now - pointer.last_move;
+	if(dt > 0){	//Smoothed so one jittery event does not decide the fling
+		pointer.velocity_x = 0.5f * pointer.velocity_x + 0.5f * (to_x - from_x) / dt;
+		pointer.velocity_y = 0.5f * pointer.velocity_y + 0.5f * (to_y - from_y) / dt;
+	}
+	pointer.last_move = now;
+}
+
+void update_inertia(){	//Move a flung pan on by the time since the last frame, slowing down
+	double now = input_now;
+	float dt = now - pointer.last_coast, decay;
+	if(!pointer.coasting) return;
+	if(dt > 0.1f) dt = 0.1f;
+	pointer.last_coast = now;
+	decay = expf(-INERTIA_FRICTION * dt);
+	view.translate_x += pointer.velocity_x * (1 - decay) / INERTIA_FRICTION;	//Exact integral over dt, so
+	view.translate_y += pointer.velocity_y * (1 - decay) / INERTIA_FRICTION;	//the glide is frame rate free
+	pointer.velocity_x *= decay;
+	pointer.velocity_y *= decay;
+	view_dirty = 1;
+	needs_redraw = 1;
+	if(fabsf(pointer.velocity_x) + fabsf(pointer.velocity_y) < INERTIA_STOP)
+		stop_coasting();
+}
+
+static void framebuffer_size_callback(GLFWwindow* window, int new_width, int new_height){	//Follow window resizes
+	stamp_input();
+	record_event('W', " %d %d", new_width, new_height);
+	mark_input();
+	width = new_width;
+	height = new_height;
+	cached_viewport(0, 0, width, height);
+	view_dirty = 1;	//Rotation depends on the aspect ratio
+	needs_redraw = 1;
+}
+
+static void window_refresh_callback(GLFWwindow* window){	//Window was uncovered or needs repainting
+	needs_redraw = 1;
+}
+
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods){	//Listen for keypresses
+	stamp_input();
+	record_event('K', " %d %d %d %d", key, scancode, action, mods);
+	if(action != GLFW_RELEASE)
+		mark_input();
+	if(key == GLFW_KEY_F1 && action == GLFW_PRESS){	//Toggle the metrics overlay
+		show_overlay = !show_overlay;
+		needs_redraw = 1;
+	}
+	if(key == GLFW_KEY_PAGE_DOWN && action != GLFW_RELEASE){	//Next and previous image, repeats while held
+		browse_step++;
+		needs_redraw = 1;
+	}
+	if(key == GLFW_KEY_PAGE_UP && action != GLFW_RELEASE){
+		browse_step--;
+		needs_redraw = 1;
+	}
+	if(key == GLFW_KEY_G && action == GLFW_PRESS){	//Contact sheet of the browse list
+		sheet_toggle = 1;
+		needs_redraw = 1;
+	}
+	if(key == GLFW_KEY_F && action == GLFW_PRESS){	//Cycle the resampling filter
+		resample_filter = (resample_filter + 1) % FILTER_COUNT;
+		printf("Filter: %s\n", FilterNames[resample_filter]);
+		needs_redraw = 1;
+	}
+	
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)	//Escape to quit functionality
         glfwSetWindowShouldClose(window, GLFW_TRUE);
 	
+	if(key == GLFW_KEY_R && action == GLFW_PRESS){	//Reset the view
+		stop_coasting();
+		note_edit(MOTION_RESET);
+		reset_view();
+	}
+	
+	if((mods & GLFW_MOD_CONTROL) && (key == GLFW_KEY_Z || key == GLFW_KEY_Y)){	//Undo and redo, repeating while
+		if(action != GLFW_RELEASE)												//held, instead of the shear keys
+			step_history(key == GLFW_KEY_Z ? -1 : 1);
+		return;	//Other keys with Ctrl do what they do without it
+	}
+	
+	if(key >= GLFW_KEY_0 && key <= GLFW_KEY_9 && action == GLFW_PRESS && !sheet.active){	//Pixel exact zoom,
+		stop_coasting();																//0 fits the window
+		note_edit(MOTION_RESET);
+		zoom_preset(key - GLFW_KEY_0);
+	}
+	if(key == GLFW_KEY_P && action == GLFW_PRESS){	//Pixel grid at high magnification
+		pixel_grid = !pixel_grid;
+		needs_redraw = 1;
+	}
+	
 	//Keypress for rotations
-	if(key == GLFW_KEY_Q && action == GLFW_PRESS)	//Single keypress
+	if(key == GLFW_KEY_Q && action == GLFW_PRESS){	//Single keypress
+		note_edit(MOTION_ROTATE);
 		rotate_matrix(25);
-	if(key == GLFW_KEY_W && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_W && action == GLFW_PRESS){
+		note_edit(MOTION_ROTATE);
 		rotate_matrix(-25);
-	if(key == GLFW_KEY_Q && action == GLFW_REPEAT)	//Held keypress
-		rotate_matrix(-.1);
-	if(key == GLFW_KEY_W && action == GLFW_REPEAT)
-		rotate_matrix(.1);
+	}
 	
 	//Keypress for scaling
-	if(key == GLFW_KEY_A && action == GLFW_PRESS)
+	if(key == GLFW_KEY_A && action == GLFW_PRESS){
+		note_edit(MOTION_SCALE);
 		scale_matrix(.9);
-	if(key == GLFW_KEY_S && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_S && action == GLFW_PRESS){
+		note_edit(MOTION_SCALE);
 		scale_matrix(1.1);
-	if(key == GLFW_KEY_A && action == GLFW_REPEAT)
-		scale_matrix(.97);
-	if(key == GLFW_KEY_S && action == GLFW_REPEAT)
-		scale_matrix(1.03);
+	}
 	
 	//Keypress for translation
-	if(key == GLFW_KEY_UP && action == GLFW_PRESS)
+	if(key == GLFW_KEY_UP && action == GLFW_PRESS){
+		note_edit(MOTION_TRANSLATE);
 		translate_matrix(0, .1);
-	if(key == GLFW_KEY_DOWN && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_DOWN && action == GLFW_PRESS){
+		note_edit(MOTION_TRANSLATE);
 		translate_matrix(0, -.1);
-	if(key == GLFW_KEY_UP && action == GLFW_REPEAT)
-		translate_matrix(0, .04);
-	if(key == GLFW_KEY_DOWN && action == GLFW_REPEAT)
-		translate_matrix(0, -.04);
-	if(key == GLFW_KEY_LEFT && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_LEFT && action == GLFW_PRESS){
+		note_edit(MOTION_TRANSLATE);
 		translate_matrix(-.1,0);
-	if(key == GLFW_KEY_RIGHT && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_RIGHT && action == GLFW_PRESS){
+		note_edit(MOTION_TRANSLATE);
 		translate_matrix(.1, 0);
-	if(key == GLFW_KEY_LEFT && action == GLFW_REPEAT)
-		translate_matrix(-.04, 0);
-	if(key == GLFW_KEY_RIGHT && action == GLFW_REPEAT)
-		translate_matrix(.04, 0);
+	}
 	
 	//Keypress for shearing
-	if(key == GLFW_KEY_Z && action == GLFW_PRESS)
+	if(key == GLFW_KEY_Z && action == GLFW_PRESS){
+		note_edit(MOTION_SHEAR);
 		shear_matrix(-.1, 0);
-	if(key == GLFW_KEY_X && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_X && action == GLFW_PRESS){
+		note_edit(MOTION_SHEAR);
 		shear_matrix(.1, 0);
-	if(key == GLFW_KEY_Z && action == GLFW_REPEAT)
-		shear_matrix(-.04, 0);
-	if(key == GLFW_KEY_X && action == GLFW_REPEAT)
-		shear_matrix(.04, 0);
-	if(key == GLFW_KEY_C && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_C && action == GLFW_PRESS){
+		note_edit(MOTION_SHEAR);
 		shear_matrix(0, -.1);
-	if(key == GLFW_KEY_V && action == GLFW_PRESS)
+	}
+	if(key == GLFW_KEY_V && action == GLFW_PRESS){
+		note_edit(MOTION_SHEAR);
 		shear_matrix(0, .1);
-	if(key == GLFW_KEY_C && action == GLFW_REPEAT)
-		shear_matrix(0, -.04);
-	if(key == GLFW_KEY_V && action == GLFW_REPEAT)
-		shear_matrix(0, .04);
+	}
+}
+
+float motion_curve(double held){	//Speed multiple for a key held this many seconds
+	float t = (held - HOLD_DELAY) / ACCELERATION_TIME;
+	if(t > 1) t = 1;
+	if(acceleration == 1)
+		return 1 + ACCELERATION_GAIN * t;
+	if(acceleration == 2)
+		return 1 + ACCELERATION_GAIN * t * t;
+	return 1;
+}
+
+void update_motion(){	//Integrate held key velocities over the time since the last frame
+	static int moving = 0;
+	double now = input_now;
+	float dt = last_motion_time > 0 ? now - last_motion_time : 0;
+	int control = key_held(GLFW_KEY_LEFT_CONTROL) || key_held(GLFW_KEY_RIGHT_CONTROL);
+	int i, held = 0;
+	
+	if(dt > 0.1f) dt = 0.1f;	//Do not jump after a stall
+	for(i = 0; i < KEY_MOTION_COUNT; i++){
+		const KeyMotion* motion = &KeyMotions[i];
+		float amount;
+		if(!key_held(motion->key) || control){	//Control makes Z undo, not shear
+			hold_start[i] = 0;
+			continue;
+		}
+		held = 1;
+		if(hold_start[i] == 0) hold_start[i] = now;
+		if(now - hold_start[i] < HOLD_DELAY) continue;	//A tap is a single step from key_callback()
+		amount = dt * motion_curve(now - hold_start[i]);
+		if(amount <= 0) continue;
+		note_edit(motion->kind);	//Joins the step the key's first tap started
+		if(motion->kind == MOTION_ROTATE)
+			rotate_matrix(motion->x * amount);
+		else if(motion->kind == MOTION_SCALE)
+			scale_matrix(expf(motion->x * amount));
+		else if(motion->kind == MOTION_TRANSLATE)
+			translate_matrix(motion->x * amount, motion->y * amount);
+		else
+			shear_matrix(motion->x * amount, motion->y * amount);
+	}
+	last_motion_time = held ? now : 0;
+	if(held != moving){	//Keep the loop polling for as long as a key is down
+		animating += held ? 1 : -1;
+		moving = held;
+	}
+}
+
+THREAD_LOCAL jmp_buf* decode_recovery = NULL;	//Set while try_read_ppm_file() and friends run on this thread
+THREAD_LOCAL Triple* decode_partial = NULL;		//Image read_ppm_header() allocated, freed if the decode fails
+THREAD_LOCAL long decode_scope = 0;				//Trace scope of the decode phase in progress, ended if it fails
+
+void decode_error(const char* format, ...){	//Report a malformed file and exit, or only fail the decode in progress
+	va_list args;								//when the caller asked to recover
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	if(decode_recovery != NULL)
+		longjmp(*decode_recovery, 1);
+	exit(1);
+}
+
+void check_image_size(double width, double height){	//Header sizes the decoders can allocate and index, so
+	if(!(width >= 1 && height >= 1) || width > INT_MAX || height > INT_MAX ||	//(size_t) w * h * 3 is exact
+			width * height > (double) (SIZE_MAX / 3))
+		decode_error("Error: Image size %.0fx%.0f is not supported, line %d\n", width, height, line);
 }
 
 // next_c() wraps the getc() function and provides error checking and line
@@ -260,10 +1325,8 @@ int next_c(FILE* ppm) {
   if (c == '\n') {
     line += 1;
   }
-  if (c == EOF) {
-    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", line);
-    exit(1);
-  }
+  if (c == EOF)
+    decode_error("Error: Unexpected end of file on line number %d.\n", line);
   return c;
 }
 
@@ -273,8 +1336,7 @@ int next_c(FILE* ppm) {
 void expect_c(FILE* ppm, int d) {
   int c = next_c(ppm);
   if (c == d) return;
-  fprintf(stderr, "Error: Expected '%c' on line %d.\n", d, line);
-  exit(1);    
+  decode_error("Error: Expected '%c' on line %d.\n", d, line);
 }
 
 
@@ -312,10 +1374,8 @@ double next_number(FILE* json) {	//Parse the next number and return it as a doub
 	double value;
 	int numDigits = 0;
 	numDigits = fscanf(json, "%lf", &value);
-	if(numDigits == 0){
-		fprintf(stderr, "Error: Expected number at line %d\n", line);
-		exit(1);
-	}
+	if(numDigits != 1)	//EOF as well as no number
+		decode_error("Error: Expected number at line %d\n", line);
 	return value;
 }
 
@@ -327,201 +1387,4336 @@ void set_window_hints(){	//Tell compiler how we should be using OpenGL
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);	//Minimum version is version 0
 }
 
-GLuint new_texture(Triple* texture_struct){	//Put our image into a texture
-	//Texture Setup -----------------------------
-	GLuint myTexture;
-	glGenTextures(1, &myTexture);	//Create new texture
-	glBindTexture(GL_TEXTURE_2D, myTexture);	//Bind texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);	//Set type of texture filter
+//Threads -----------------------------
+
+void mutex_init(Mutex* mutex){
+#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void mutex_lock(Mutex* mutex){
+#ifdef _WIN32
+	EnterCriticalSection(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+void mutex_unlock(Mutex* mutex){
+#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+void condition_init(Condition* condition){
+#ifdef _WIN32
+	InitializeConditionVariable(condition);
+#else
+	pthread_cond_init(condition, NULL);
+#endif
+}
+
+void condition_wait(Condition* condition, Mutex* mutex){
+#ifdef _WIN32
+	SleepConditionVariableCS(condition, mutex, INFINITE);
+#else
+	pthread_cond_wait(condition, mutex);
+#endif
+}
+
+void condition_broadcast(Condition* condition){
+#ifdef _WIN32
+	WakeAllConditionVariable(condition);
+#else
+	pthread_cond_broadcast(condition);
+#endif
+}
+
+#ifdef _WIN32
+typedef struct{		//This struct adapts a pthread style entry point to CreateThread
+	void* (*function)(void*);
+	void* arg;
+} ThreadStart;
+
+static DWORD WINAPI thread_trampoline(LPVOID start_arg){
+	ThreadStart start = *(ThreadStart*) start_arg;
+	free(start_arg);
+	start.function(start.arg);
+	return 0;
+}
+#endif
+
+void thread_start(void* (*function)(void*), void* arg){	//Start a detached thread
+#ifdef _WIN32
+	ThreadStart* start = malloc(sizeof(ThreadStart));
+	HANDLE handle;
+	start->function = function;
+	start->arg = arg;
+	handle = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+	if(handle == NULL){
+		fprintf(stderr, "Error: Could not start a thread\n");
+		exit(1);
+	}
+	CloseHandle(handle);
+#else
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, function, arg) != 0){
+		fprintf(stderr, "Error: Could not start a thread\n");
+		exit(1);
+	}
+	pthread_detach(thread);
+#endif
+}
+
+long atomic_increment(volatile long* value){	//Add one and return the new value
+#ifdef _WIN32
+	return InterlockedIncrement(value);
+#else
+	return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+int cpu_count(){	//Number of logical processors
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? count : 1;
+#endif
+}
+
+void* pool_worker(void* arg){	//Wait for parallel_for() work and help with it
+	int generation = 0;
+	while(1){
+		long index;
+		mutex_lock(&pool.lock);
+		while(pool.generation == generation)
+			condition_wait(&pool.start, &pool.lock);
+		generation = pool.generation;
+		mutex_unlock(&pool.lock);
+		
+		while((index = atomic_increment(&pool.next) - 1) < pool.count)
+			pool.function(pool.arg, index);
+		
+		mutex_lock(&pool.lock);
+		if(--pool.busy == 0)
+			condition_broadcast(&pool.done);
+		mutex_unlock(&pool.lock);
+	}
+	return NULL;
+}
+
+void parallel_for(int count, void (*function)(void*, int), void* arg){	//Call function(arg, i) for i < count on every thread
+	long index;
+	if(pool.threads == 0){	//Start the workers on first use
+		int i;
+		mutex_init(&pool.lock);
+		condition_init(&pool.start);
+		condition_init(&pool.done);
+		pool.threads = thread_count > 0 ? thread_count : cpu_count();
+		for(i = 1; i < pool.threads; i++)	//The caller is a worker too
+			thread_start(pool_worker, NULL);
+	}
+	mutex_lock(&pool.lock);
+	pool.function = function;
+	pool.arg = arg;
+	pool.count = count;
+	pool.next = 0;
+	pool.busy = pool.threads - 1;
+	pool.generation++;
+	condition_broadcast(&pool.start);
+	mutex_unlock(&pool.lock);
+	
+	while((index = atomic_increment(&pool.next) - 1) < count)
+		function(arg, index);
+	
+	mutex_lock(&pool.lock);
+	while(pool.busy > 0)
+		condition_wait(&pool.done, &pool.lock);
+	mutex_unlock(&pool.lock);
+}
+
+long atomic_add(volatile long* value, long amount){	//Add amount and return the new value
+#ifdef _WIN32
+	return InterlockedExchangeAdd(value, amount) + amount;
+#else
+	return __sync_add_and_fetch(value, amount);
+#endif
+}
+
+long long atomic_add64(volatile long long* value, long long amount){	//atomic_add() for byte counts, long is
+#ifdef _WIN32																//32 bits on Windows
+	return InterlockedExchangeAdd64(value, amount) + amount;
+#else
+	return __sync_add_and_fetch(value, amount);
+#endif
+}
+
+void push_task(TaskDeque* deque, Task task){	//Owner end of a deque, grows as needed
+	mutex_lock(&deque->lock);
+	if(deque->bottom - deque->top == deque->capacity || deque->bottom == deque->capacity){
+		int count = deque->bottom - deque->top;
+		Task* tasks = malloc(sizeof(Task) * (deque->capacity * 2 + 16));
+		if(tasks == NULL){
+			fprintf(stderr, "Error: Out of memory queueing work\n");
+			exit(1);
+		}
+		if(count > 0) memcpy(tasks, deque->tasks + deque->top, sizeof(Task) * count);
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->capacity = deque->capacity * 2 + 16;
+		deque->top = 0;
+		deque->bottom = count;
+	}
+	deque->tasks[deque->bottom++] = task;
+	mutex_unlock(&deque->lock);
+}
+
+int pop_task(TaskDeque* deque, Task* task, int steal){	//Newest task for the owner, oldest for a thief
+	int found = 0;
+	mutex_lock(&deque->lock);
+	if(deque->bottom > deque->top){
+		*task = steal ? deque->tasks[deque->top++] : deque->tasks[--deque->bottom];
+		found = 1;
+	}
+	mutex_unlock(&deque->lock);
+	return found;
+}
+
+void sleep_ms(int milliseconds){
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	usleep(milliseconds * 1000);
+#endif
+}
+void memory_barrier(){	//Order the loads and stores on either side, for data shared without a lock
+#ifdef _WIN32
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+void submit_task(int worker, void (*function)(void*, int), void* arg){	//Queue work, on the caller's own deque for workers
+	static volatile long next_deque = 0;
+	Task task;
+	task.function = function;
+	task.arg = arg;
+	if(worker < 0)	//Outside the pool, spread submissions round robin
+		worker = (atomic_increment(&next_deque) - 1) % stealer.workers;
+	atomic_increment(&stealer.pending);
+	push_task(&stealer.deques[worker], task);
+	atomic_increment(&stealer.queued);
+	mutex_lock(&stealer.lock);
+	condition_broadcast(&stealer.wake);
+	mutex_unlock(&stealer.lock);
+}
+
+void* stealing_worker(void* arg){	//Run own tasks newest first, then steal the oldest from others
+	int worker = (int) (size_t) arg, i;
+	while(1){
+		Task task;
+		int found = pop_task(&stealer.deques[worker], &task, 0);
+		for(i = 1; !found && i < stealer.workers; i++)
+			found = pop_task(&stealer.deques[(worker + i) % stealer.workers], &task, 1);
+		if(!found){	//Nothing anywhere, sleep until something is queued
+			mutex_lock(&stealer.lock);
+			while(stealer.queued == 0)
+				condition_wait(&stealer.wake, &stealer.lock);
+			mutex_unlock(&stealer.lock);
+			continue;
+		}
+		atomic_add(&stealer.queued, -1);
+		task.function(task.arg, worker);
+		if(atomic_add(&stealer.pending, -1) == 0){
+			mutex_lock(&stealer.lock);
+			condition_broadcast(&stealer.idle);
+			mutex_unlock(&stealer.lock);
+		}
+	}
+	return NULL;
+}
+
+void start_stealing_pool(){	//Start one stealing worker per thread, once
+	int i;
+	if(stealer.workers > 0) return;
+	mutex_init(&stealer.lock);
+	condition_init(&stealer.wake);
+	condition_init(&stealer.idle);
+	stealer.workers = thread_count > 0 ? thread_count : cpu_count();
+	stealer.deques = calloc(stealer.workers, sizeof(TaskDeque));
+	for(i = 0; i < stealer.workers; i++)
+		mutex_init(&stealer.deques[i].lock);
+	for(i = 0; i < stealer.workers; i++)
+		thread_start(stealing_worker, (void*) (size_t) i);
+}
+
+void wait_for_tasks(){	//Block until every submitted task, and the tasks they submitted, has run
+	mutex_lock(&stealer.lock);
+	while(stealer.pending > 0)
+		condition_wait(&stealer.idle, &stealer.lock);
+	mutex_unlock(&stealer.lock);
+}
+//-------------------------------------
+
+//Tracing -----------------------------
+
+#define TRACE_CAPACITY 65536	//Events kept, later ones are counted and dropped
+
+typedef struct{		//This struct is one event in Chrome's trace event format
+	const char* category;	//Static strings only, they are not written out until exit
+	const char* name;
+	double timestamp;		//From now_seconds()
+	double duration;		//Complete events only, filled in by trace_end()
+	long thread;
+	volatile char phase;	//'X' complete or 'i' instant, set last so write_trace() skips half written events
+} TraceEvent;
+
+struct{		//This struct collects events from every thread until write_trace()
+	char* path;				//Where the JSON goes (--trace)
+	int enabled;			//Cleared again while the events are written
+	TraceEvent* events;
+	volatile long count;	//Slots claimed, may run past TRACE_CAPACITY
+	volatile long threads;	//Trace thread ids handed out, the main thread is 1
+	double start;			//Timestamps are written relative to this
+} trace;
+
+THREAD_LOCAL long trace_thread = 0;	//This thread's id in the trace, 0 until its first event
+
+long add_trace_event(char phase, const char* category, const char* name){	//Returns a handle for trace_end(), 0 if none
+	TraceEvent* event;
+	long index;
+	if(!trace.enabled) return 0;
+	if(trace_thread == 0) trace_thread = atomic_increment(&trace.threads);
+	index = atomic_increment(&trace.count) - 1;
+	if(index >= TRACE_CAPACITY) return 0;	//Full, write_trace() says how many were lost
+	event = &trace.events[index];
+	event->category = category;
+	event->name = name;
+	event->thread = trace_thread;
+	event->duration = 0;
+	event->timestamp = now_seconds();
+	memory_barrier();
+	event->phase = phase;
+	return index + 1;
+}
+
+long trace_begin(const char* category, const char* name){	//Open a scope, close it with trace_end()
+	return add_trace_event('X', category, name);
+}
+
+void trace_end(long handle){	//Close a scope from trace_begin(), on the same thread
+	if(handle > 0)
+		trace.events[handle - 1].duration = now_seconds() - trace.events[handle - 1].timestamp;
+}
+
+void begin_decode_scope(const char* name){	//trace_begin() of a decoder phase, one at a time per thread
+	decode_scope = trace_begin("load", name);
+}
+
+void end_decode_scope(){	//Close the phase, also how a recovery path closes one decode_error() left open
+	trace_end(decode_scope);
+	decode_scope = 0;
+}
+
+void trace_instant(const char* category, const char* name){	//A single point in time
+	add_trace_event('i', category, name);
+}
+
+void write_trace(){	//Write the events as JSON for chrome://tracing or Perfetto, runs at exit
+	long i, count = trace.count < TRACE_CAPACITY ? trace.count : TRACE_CAPACITY;
+	FILE* out;
+	if(!trace.enabled) return;
+	trace.enabled = 0;	//Nothing more is added while writing
+	out = fopen(trace.path, "w");
+	if(out == NULL){
+		fprintf(stderr, "Error: Could not open %s for writing\n", trace.path);
+		return;
+	}
+	fprintf(out, "{\"traceEvents\":[\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"ezview\"}}");
+	for(i = 1; i <= trace.threads; i++){
+		if(i == 1)
+			fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}}");
+		else
+			fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%ld,\"args\":{\"name\":\"worker %ld\"}}", i, i - 1);
+	}
+	for(i = 0; i < count; i++){
+		TraceEvent* event = &trace.events[i];
+		if(event->phase == 0) continue;	//Claimed by a thread that was still filling it in
+		fprintf(out, ",\n{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%ld,\"ts\":%.3f",
+				event->phase, event->category, event->name, event->thread, (event->timestamp - trace.start) * 1e6);
+		if(event->phase == 'X')
+			fprintf(out, ",\"dur\":%.3f}", event->duration * 1e6);
+		else
+			fprintf(out, ",\"s\":\"t\"}");	//Instants are scoped to their thread
+	}
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	if(trace.count > TRACE_CAPACITY)
+		fprintf(stderr, "Note: The trace was full, %ld events were dropped\n", trace.count - TRACE_CAPACITY);
+}
+
+void start_trace(char* path){	//Record from here on, the events are written when the program exits
+	trace.path = path;
+	trace.events = calloc(TRACE_CAPACITY, sizeof(TraceEvent));
+	if(trace.events == NULL){
+		fprintf(stderr, "Error: Could not allocate the trace buffer\n");
+		exit(1);
+	}
+	trace.start = now_seconds();
+	trace_thread = atomic_increment(&trace.threads);	//Called from main, so it gets id 1
+	trace.enabled = 1;
+	atexit(write_trace);
+}
+//-------------------------------------
+
+//Startup report -----------------------------
+
+enum {STARTUP_PROCESS, STARTUP_ARGUMENTS, STARTUP_DECODE, STARTUP_GLFW, STARTUP_WINDOW, STARTUP_UPLOAD,
+		STARTUP_SHADERS, STARTUP_SETUP, STARTUP_FIRST_FRAME, STARTUP_PHASES};
+
+const char* StartupPhaseNames[STARTUP_PHASES] = {"process start", "arguments", "decode", "glfwInit", "window creation",
+		"texture upload", "shader compile/link", "other setup", "first swap"};
+
+struct{		//This struct holds the phase times of a startup being timed
+	int runs;						//Cold and warm startups to time (--startup-report), 0 if off
+	int child;						//Set in the timed process, it reports and exits after the first swap
+	double spawned;					//now_seconds() when the parent started this process
+	double main_entry;				//now_seconds() on entering main()
+	double marks[STARTUP_PHASES];	//now_seconds() at the end of each phase
+} startup;
+
+void startup_mark(int phase){	//End a phase of a timed startup, the next one starts here
+	if(startup.child)
+		startup.marks[phase] = now_seconds();
+}
+
+void finish_startup(){	//Report the phases to the parent in milliseconds and exit, call after the first swap
+	double previous = startup.spawned;
+	int i;
+	printf("startup");
+	for(i = 0; i < STARTUP_PHASES; i++){
+		printf(" %.3f", (startup.marks[i] - previous) * 1000);
+		previous = startup.marks[i];
+	}
+	printf("\n");
+	fflush(stdout);
+	exit(EXIT_SUCCESS);
+}
+
+int drop_file_cache(char* path){	//Evict cached file pages before a cold start, 2 for the whole cache,
+								//1 for just this file, 0 if nothing can be dropped
+#ifdef __linux__
+	FILE* control;
+	int file;
+	sync();
+	control = fopen("/proc/sys/vm/drop_caches", "w");	//Root only
+	if(control != NULL){
+		int written = fputs("3\n", control) >= 0;
+		if(fclose(control) == 0 && written)
+			return 2;
+	}
+	file = open(path, O_RDONLY);	//Anyone can ask for their own clean pages to go
+	if(file < 0 || posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) != 0){
+		if(file >= 0) close(file);
+		return 0;
+	}
+	close(file);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+#ifdef _WIN32
+void append_argument(char* command, size_t size, const char* argument){	//Quote one argument so the C runtime
+	size_t length = strlen(command);										//of the child splits it back out unchanged
+	int backslashes = 0;
+	if(length > 0 && length < size - 1) command[length++] = ' ';
+	if(length < size - 1) command[length++] = '"';
+	for(; *argument && length < size - 1; argument++){
+		if(*argument == '\\'){
+			backslashes++;
+		}else{
+			if(*argument == '"')	//Backslashes before a quote are escapes, so double them and escape the quote
+				for(backslashes++; backslashes > 0 && length < size - 1; backslashes--)	//n are already out
+					command[length++] = '\\';
+			backslashes = 0;
+		}
+		command[length++] = *argument;
+	}
+	for(; backslashes > 0 && length < size - 1; backslashes--)	//Double the trailing ones, the closing quote follows
+		command[length++] = '\\';
+	if(length < size - 1) command[length++] = '"';
+	command[length] = 0;
+}
+#endif
+
+int time_startup(char** child_argv, double* times){	//Start the viewer once and read back its phases, the last
+													//entry of times is the total, returns 0 if it did not report
+	char* spawned = child_argv[2];	//Filled in just before the start, the child measures from it
+	char line[1024];
+	FILE* report;
+	int reported = 0, i;
+#ifdef _WIN32
+	char command[32768] = "";	//Longest command line CreateProcess takes
+	SECURITY_ATTRIBUTES inherited = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+	STARTUPINFOA start_info;
+	PROCESS_INFORMATION process;
+	HANDLE read_end, write_end;
+	if(!CreatePipe(&read_end, &write_end, &inherited, 0)){
+		fprintf(stderr, "Error: Could not create a pipe\n");
+		exit(1);
+	}
+	SetHandleInformation(read_end, HANDLE_FLAG_INHERIT, 0);	//Only the child's end goes across
+	memset(&start_info, 0, sizeof(start_info));
+	start_info.cb = sizeof(start_info);
+	start_info.dwFlags = STARTF_USESTDHANDLES;	//Report on stdout, straight into the pipe
+	start_info.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	start_info.hStdOutput = write_end;
+	start_info.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+	sprintf(spawned, "%.9f", now_seconds());
+	for(i = 0; child_argv[i] != NULL; i++)	//No shell in between, so quotes and % reach the child as typed
+		append_argument(command, sizeof(command), child_argv[i]);
+	if(!CreateProcessA(NULL, command, NULL, NULL, TRUE, 0, NULL, NULL, &start_info, &process)){
+		fprintf(stderr, "Error: Could not start %s\n", child_argv[0]);
+		exit(1);
+	}
+	CloseHandle(write_end);	//So the read ends when the child exits
+	CloseHandle(process.hThread);
+	report = _fdopen(_open_osfhandle((intptr_t) read_end, _O_RDONLY), "r");
+#else
+	int pipe_ends[2], status;
+	pid_t child;
+	if(pipe(pipe_ends) != 0){
+		fprintf(stderr, "Error: Could not create a pipe\n");
+		exit(1);
+	}
+	sprintf(spawned, "%.9f", now_seconds());
+	child = fork();
+	if(child == 0){	//Report on stdout, straight into the pipe
+		dup2(pipe_ends[1], 1);
+		close(pipe_ends[0]);
+		close(pipe_ends[1]);
+		execvp(child_argv[0], child_argv);
+		_exit(127);
+	}
+	close(pipe_ends[1]);
+	if(child < 0){
+		fprintf(stderr, "Error: Could not start %s\n", child_argv[0]);
+		exit(1);
+	}
+	report = fdopen(pipe_ends[0], "r");
+#endif
+	while(fgets(line, sizeof(line), report) != NULL){
+		char* next = line + 7;
+		if(strncmp(line, "startup ", 8) != 0) continue;	//Anything else the viewer printed
+		times[STARTUP_PHASES] = 0;
+		for(i = 0; i < STARTUP_PHASES; i++){
+			times[i] = strtod(next, &next);
+			times[STARTUP_PHASES] += times[i];
+		}
+		reported = 1;
+	}
+	fclose(report);
+#ifdef _WIN32
+	WaitForSingleObject(process.hProcess, INFINITE);
+	CloseHandle(process.hProcess);
+#else
+	waitpid(child, &status, 0);
+#endif
+	return reported;
+}
+
+int compare_doubles(const void* a, const void* b){
+	double difference = *(const double*) a - *(const double*) b;
+	return (difference > 0) - (difference < 0);
+}
+
+void summarize_startup(const char* label, double* times, int runs){	//Statistics per phase, times holds runs rows
+	int i, phase;
+	double* column = malloc(runs * sizeof(double));
+	printf("%s startup, %d runs (ms)\n%-22s %9s %9s %9s %9s %9s\n", label, runs, "phase", "mean", "median", "stddev",
+			"min", "max");
+	for(phase = 0; phase <= STARTUP_PHASES; phase++){
+		double sum = 0, squares = 0, mean, median;
+		for(i = 0; i < runs; i++){
+			column[i] = times[i * (STARTUP_PHASES + 1) + phase];
+			sum += column[i];
+		}
+		mean = sum / runs;
+		for(i = 0; i < runs; i++)
+			squares += (column[i] - mean) * (column[i] - mean);
+		qsort(column, runs, sizeof(double), compare_doubles);
+		median = runs % 2 ? column[runs / 2] : (column[runs / 2 - 1] + column[runs / 2]) / 2;
+		printf("%-22s %9.2f %9.2f %9.2f %9.2f %9.2f\n", phase < STARTUP_PHASES ? StartupPhaseNames[phase] : "time to first frame",
+				mean, median, runs > 1 ? sqrt(squares / (runs - 1)) : 0, column[0], column[runs - 1]);
+	}
+	free(column);
+}
+
+int run_startup_report(int argc, char** argv, char* input_name){	//--startup-report RUNS: time cold and warm
+																	//startups of the same command line
+	int columns = STARTUP_PHASES + 1, cold = 0, i, j;
+	double* cold_times = malloc(startup.runs * columns * sizeof(double));
+	double* warm_times = malloc(startup.runs * columns * sizeof(double));
+	char spawned[64];
+	char** child_argv = malloc((argc + 3) * sizeof(char*));
+	
+	child_argv[0] = argv[0];	//The same options, less this one, plus the start time
+	child_argv[1] = "--startup-child";
+	child_argv[2] = spawned;
+	for(i = 1, j = 3; i < argc; i++){
+		if(strcmp(argv[i], "--startup-report") == 0)
+			i++;
+		else
+			child_argv[j++] = argv[i];
+	}
+	child_argv[j] = NULL;
+	
+	for(i = 0; i < startup.runs; i++){	//Cold then warm, so each warm start follows a run that loaded everything
+		if(i == 0 || cold > 0)
+			cold = drop_file_cache(input_name);
+		if(cold > 0 && !time_startup(child_argv, cold_times + i * columns))
+			break;
+		if(cold == 0 && i == 0)	//Nothing to drop, so warm the cache with an untimed start instead
+			time_startup(child_argv, warm_times);
+		if(!time_startup(child_argv, warm_times + i * columns))
+			break;
+	}
+	if(i < startup.runs){
+		fprintf(stderr, "Error: A timed startup of %s did not reach its first frame\n", input_name);
+		exit(1);
+	}
+	if(cold == 0)
+		fprintf(stderr, "Note: The file cache cannot be dropped here, so only warm startups were timed\n");
+	else if(cold == 1)
+		fprintf(stderr, "Note: Only %s was evicted before cold startups, run as root to drop the whole file cache\n",
+				input_name);
+	if(cold > 0)
+		summarize_startup("Cold", cold_times, startup.runs);
+	summarize_startup("Warm", warm_times, startup.runs);
+	free(cold_times);
+	free(warm_times);
+	free(child_argv);
+	return EXIT_SUCCESS;
+}
+//-------------------------------------
+
+//Program binary cache -----------------------------
+
+#define PROGRAM_CACHE_VERSION 1			//Bump when the file layout or the attribute bindings change
+#define PROGRAM_CACHE_LIMIT (64 << 20)	//Largest binary read back, anything bigger is a corrupt file
+
+typedef struct{		//This struct starts every file in the program binary cache
+	char magic[4];		//"EZPB"
+	uint32_t version;	//PROGRAM_CACHE_VERSION
+	uint64_t key;		//program_key(), guards against renamed or colliding files
+	uint32_t format;	//From glGetProgramBinaryOES
+	uint32_t length;	//Bytes of binary after this header
+} ProgramCacheHeader;
+
+struct{		//This struct holds the on-disk cache of linked programs
+	char* path;				//Directory (--shader-cache), a per user cache directory if NULL
+	int state;				//0 until init_program_cache() runs, 1 usable, -1 off
+	uint64_t driver_key;	//Hash of the vendor, renderer and version strings
+	PFNGLGETPROGRAMBINARYOESPROC get_binary;
+	PFNGLPROGRAMBINARYOESPROC load_binary;
+} program_cache;
+
+#define HASH_START 14695981039346656037ull	//FNV-1a offset basis, where every hash_bytes() chain begins
+
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size){	//64 bit FNV-1a, the one hash in the program
+	const unsigned char* bytes = data;
+	size_t i;
+	for(i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+uint64_t hash_string(uint64_t hash, const char* text){	//hash_bytes() of text and its terminator, so
+	return hash_bytes(hash, text == NULL ? "" : text, text == NULL ? 1 : strlen(text) + 1);	//"ab","c" != "a","bc"
+}
+
+void make_directory(const char* path){	//Create one directory level, it is fine if it exists
+#ifdef _WIN32
+	CreateDirectoryA(path, NULL);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+char* default_program_cache_path(){	//LOCALAPPDATA\ezview on Windows, the XDG cache directory elsewhere
+	char* path;
+#ifdef _WIN32
+	const char* base = getenv("LOCALAPPDATA");
+	if(base == NULL) return NULL;
+	path = malloc(strlen(base) + 8);
+	sprintf(path, "%s\\ezview", base);
+#else
+	const char* base = getenv("XDG_CACHE_HOME");
+	if(base == NULL || base[0] == '\0'){
+		const char* home = getenv("HOME");
+		if(home == NULL) return NULL;
+		path = malloc(strlen(home) + 15);
+		sprintf(path, "%s/.cache", home);
+		make_directory(path);
+		strcat(path, "/ezview");
+	}else{
+		path = malloc(strlen(base) + 8);
+		sprintf(path, "%s/ezview", base);
+	}
+#endif
+	make_directory(path);
+	return path;
+}
+
+int init_program_cache(){	//Look up the extension and the directory once, returns 1 if programs can be cached
+	const char* extensions;
+	GLint formats = 0;
+	if(program_cache.state != 0)
+		return program_cache.state > 0;
+	program_cache.state = -1;
+	extensions = (const char*) glGetString(GL_EXTENSIONS);
+	if(extensions == NULL || strstr(extensions, "GL_OES_get_program_binary") == NULL)
+		return 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if(formats <= 0)	//Advertised, but there is no format to save in
+		return 0;
+	program_cache.get_binary = (PFNGLGETPROGRAMBINARYOESPROC) eglGetProcAddress("glGetProgramBinaryOES");
+	program_cache.load_binary = (PFNGLPROGRAMBINARYOESPROC) eglGetProcAddress("glProgramBinaryOES");
+	if(program_cache.get_binary == NULL || program_cache.load_binary == NULL)
+		return 0;
+	if(program_cache.path == NULL && (program_cache.path = default_program_cache_path()) == NULL)
+		return 0;
+	program_cache.driver_key = hash_string(HASH_START, (const char*) glGetString(GL_VENDOR));
+	program_cache.driver_key = hash_string(program_cache.driver_key, (const char*) glGetString(GL_RENDERER));
+	program_cache.driver_key = hash_string(program_cache.driver_key, (const char*) glGetString(GL_VERSION));
+	program_cache.state = 1;
+	return 1;
+}
+
+uint64_t program_key(char* fragment_src){	//Cache key of the program simple_program() would link
+	uint32_t version = PROGRAM_CACHE_VERSION;
+	uint64_t key = hash_bytes(program_cache.driver_key, &version, sizeof(version));
+	key = hash_string(key, vertex_shader_src);
+	return hash_string(key, fragment_src);
+}
+
+void program_cache_name(char* name, size_t size, uint64_t key){	//File holding the program with this key
+	snprintf(name, size, "%s/%08x%08x.bin", program_cache.path, (unsigned) (key >> 32), (unsigned) key);
+}
+
+int load_program_binary(GLuint program_id, uint64_t key){	//Link program_id from the cache, returns 0 if the
+	ProgramCacheHeader header;								//binary is missing, damaged or refused by the driver
+	GLint linked = GL_FALSE;
+	char name[1024];
+	void* binary;
+	long scope;
+	FILE* file;
+	
+	program_cache_name(name, sizeof(name), key);
+	if((file = fopen(name, "rb")) == NULL)
+		return 0;
+	scope = trace_begin("gl", "load program binary");
+	if(fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "EZPB", 4) == 0 &&
+			header.version == PROGRAM_CACHE_VERSION && header.key == key && header.length <= PROGRAM_CACHE_LIMIT &&
+			(binary = malloc(header.length)) != NULL){
+		if(fread(binary, 1, header.length, file) == header.length){
+			program_cache.load_binary(program_id, header.format, binary, header.length);
+			glGetProgramiv(program_id, GL_LINK_STATUS, &linked);	//Refused after driver updates, among others
+		}
+		free(binary);
+	}
+	fclose(file);
+	trace_end(scope);
+	return linked == GL_TRUE;
+}
+
+void save_program_binary(GLuint program_id, uint64_t key){	//Store a linked program, failures only cost the next
+	ProgramCacheHeader header;								//start a compile
+	GLint length = 0;
+	GLenum format;
+	char name[1024], temporary[1040];
+	void* binary;
+	FILE* file;
+	int written;
+	long scope;
+	
+	glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if(length <= 0 || length > PROGRAM_CACHE_LIMIT || (binary = malloc(length)) == NULL)
+		return;
+	scope = trace_begin("gl", "save program binary");
+	program_cache.get_binary(program_id, length, &length, &format, binary);
+	memcpy(header.magic, "EZPB", 4);
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.length = length;
+	program_cache_name(name, sizeof(name), key);
+	sprintf(temporary, "%s.tmp", name);	//Written aside and renamed, so a reader never sees half a file
+	if((file = fopen(temporary, "wb")) != NULL){
+		written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary, 1, length, file) == (size_t) length;
+		if(fclose(file) == 0 && written){
+#ifdef _WIN32
+			MoveFileExA(temporary, name, MOVEFILE_REPLACE_EXISTING);
+#else
+			rename(temporary, name);
+#endif
+		}else
+			remove(temporary);
+	}
+	free(binary);
+	trace_end(scope);
+}
+//-------------------------------------
+
+GLint simple_shader(GLint shader_type, char* shader_src) {	//Create simple shader, error check
+
+  GLint compile_success = 0;
+
+  int shader_id = glCreateShader(shader_type);	//Create shader
+
+  glShaderSource(shader_id, 1, (const GLchar* const*) &shader_src, 0);	//Add information from earlier into shader
+
+  long scope = trace_begin("gl", shader_type == GL_VERTEX_SHADER ? "compile vertex shader" : "compile fragment shader");
+
+  glCompileShader(shader_id);	//Compile shader
+
+  glGetShaderiv(shader_id, GL_COMPILE_STATUS, &compile_success);	//See if the shader was compiled, drivers may only compile here
+  trace_end(scope);
+
+  if (compile_success == GL_FALSE) {
+    GLchar message[256];
+    glGetShaderInfoLog(shader_id, sizeof(message), 0, &message[0]);
+    printf("glCompileShader Error: %s\n", message);
+    exit(1);
+  }
+
+  return shader_id;
+}
+
+
+int simple_program(char* fragment_src) {	//Create simple program for OpenGL to use
+
+  GLint link_success = 0;
+  uint64_t key = 0;
+
+  GLint program_id = glCreateProgram();	//Create program
+  if(init_program_cache()){	//Use the program linked on an earlier run, if the driver takes it back
+    key = program_key(fragment_src);
+    if(load_program_binary(program_id, key))
+      return program_id;
+    glDeleteProgram(program_id);	//Start over from a fresh program in case a binary was refused
+    program_id = glCreateProgram();
+  }
+  //Create shaders
+  GLint vertex_shader = simple_shader(GL_VERTEX_SHADER, vertex_shader_src);
+  GLint fragment_shader = simple_shader(GL_FRAGMENT_SHADER, fragment_src);
+  
+  //Attach shaders
+  glAttachShader(program_id, vertex_shader);
+  glAttachShader(program_id, fragment_shader);
+  
+  //Same attribute locations in every program, so vertex attribute pointers stay valid across them
+  glBindAttribLocation(program_id, ATTRIBUTE_POSITION, "Position");
+  glBindAttribLocation(program_id, ATTRIBUTE_COLOR, "SourceColor");
+  glBindAttribLocation(program_id, ATTRIBUTE_TEXCOORD, "TexCoordIn");
+
+  long scope = trace_begin("gl", "link program");
+
+  glLinkProgram(program_id);	//Link program
+
+  glGetProgramiv(program_id, GL_LINK_STATUS, &link_success);	//See if program link was successful
+  trace_end(scope);
+
+  if (link_success == GL_FALSE) {
+    GLchar message[256];
+    glGetProgramInfoLog(program_id, sizeof(message), 0, &message[0]);
+    printf("glLinkProgram Error: %s\n", message);
+    exit(1);
+  }
+  if(key != 0)
+    save_program_binary(program_id, key);
+
+  return program_id;
+}
+
+//Resampling -----------------------------
+
+float filter_kernel(int filter, float x){	//Weight of a sample x texels from the centre
+	x = fabsf(x);
+	if(filter == FILTER_NEAREST)
+		return x < 0.5f ? 1 : 0;
+	if(filter == FILTER_BILINEAR)
+		return x < 1 ? 1 - x : 0;
+	if(filter == FILTER_BICUBIC){	//Catmull-Rom, matches filtered_fragment_src
+		if(x < 1) return (1.5f * x - 2.5f) * x * x + 1;
+		if(x < 2) return ((-0.5f * x + 2.5f) * x - 4) * x + 2;
+		return 0;
+	}
+	if(x < 1e-5f) return 1;	//Lanczos-3
+	if(x >= 3) return 0;
+	return 3 * sinf((float) M_PI * x) * sinf((float) M_PI * x / 3) / ((float) (M_PI * M_PI) * x * x);
+}
+
+float filter_support(int filter){	//Radius in texels where filter_kernel() becomes zero
+	static const float support[FILTER_COUNT] = {0.5f, 1, 2, 3};
+	return support[filter];
+}
+
+void init_kernel_tables(){	//Sample every kernel once, call before any thread resamples
+	int filter, i;
+	for(filter = 0; filter < FILTER_COUNT; filter++)
+		for(i = 0; i < 3 * KERNEL_RESOLUTION + 2; i++)
+			kernel_table[filter][i] = filter_kernel(filter, (float) i / KERNEL_RESOLUTION);
+}
+
+float table_kernel(int filter, float x){	//filter_kernel() by table lookup
+	int i = (int) (fabsf(x) * KERNEL_RESOLUTION + 0.5f);
+	return i < 3 * KERNEL_RESOLUTION + 2 ? kernel_table[filter][i] : 0;
+}
+
+int filter_weights(int filter, float center, float widen, int size, int* index, float* weight){	//Taps around center
+	float radius = filter_support(filter) * widen, total = 0;
+	int first = (int) ceilf(center - radius), last = (int) floorf(center + radius), count = 0, i;
+	if(last - first + 1 > MAX_FILTER_TAPS){	//Very strong shrinking, keep the taps nearest the centre
+		first = (int) floorf(center) - MAX_FILTER_TAPS / 2 + 1;
+		last = first + MAX_FILTER_TAPS - 1;
+	}
+	for(i = first; i <= last; i++){
+		float w = table_kernel(filter, (i - center) / widen);
+		if(w == 0) continue;
+		index[count] = i < 0 ? 0 : (i >= size ? size - 1 : i);	//Clamp to edge
+		weight[count++] = w;
+		total += w;
+	}
+	if(count == 0){	//Nearest can fall between taps at exact halves
+		index[0] = (int) floorf(center + 0.5f);
+		index[0] = index[0] < 0 ? 0 : (index[0] >= size ? size - 1 : index[0]);
+		weight[0] = 1;
+		return 1;
+	}
+	for(i = 0; i < count; i++)	//Normalize so flat areas stay flat
+		weight[i] /= total;
+	return count;
+}
+
+#ifdef USE_SSE2
+static __m128 load_texel_ps(const GLubyte* texel){	//RGB bytes as four floats, the last is zero
+	int packed = texel[0] | (texel[1] << 8) | (texel[2] << 16);
+	__m128i zero = _mm_setzero_si128();
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero));
+}
+
+static void store_texel_ps(__m128 color, GLubyte* out){	//Round, saturate and store three channels
+	__m128i packed = _mm_cvtps_epi32(color);
+	int bytes;
+	packed = _mm_packs_epi32(packed, packed);
+	packed = _mm_packus_epi16(packed, packed);
+	bytes = _mm_cvtsi128_si32(packed);
+	out[0] = bytes & 0xff;
+	out[1] = (bytes >> 8) & 0xff;
+	out[2] = (bytes >> 16) & 0xff;
+}
+#endif
+
+static GLubyte clamp_byte(float value){
+	return value <= 0 ? 0 : (value >= 255 ? 255 : (GLubyte) (value + 0.5f));
+}
+
+void filter_pixel(Triple* source, int filter, float s, float t, float widen_s, float widen_t, GLubyte* out){	//Separable
+															//kernel sample at texel coordinate (s, t)
+	int xs[MAX_FILTER_TAPS], ys[MAX_FILTER_TAPS];
+	float wx[MAX_FILTER_TAPS], wy[MAX_FILTER_TAPS];
+	int source_width = source->width, source_height = source->height;
+	int x_count = filter_weights(filter, s, widen_s, source_width, xs, wx);
+	int y_count = filter_weights(filter, t, widen_t, source_height, ys, wy);
+	int i, j;
+#ifdef USE_SSE2
+	__m128 sum = _mm_setzero_ps();
+	for(j = 0; j < y_count; j++){	//Filter each row across, then the row sums down
+		const GLubyte* row = source->texture_pixels + (size_t) ys[j] * source_width * 3;
+		__m128 row_sum = _mm_setzero_ps();
+		for(i = 0; i < x_count; i++)
+			row_sum = _mm_add_ps(row_sum, _mm_mul_ps(load_texel_ps(row + xs[i] * 3), _mm_set1_ps(wx[i])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(row_sum, _mm_set1_ps(wy[j])));
+	}
+	store_texel_ps(sum, out);
+#else
+	float sum[3] = {0, 0, 0};
+	for(j = 0; j < y_count; j++){
+		const GLubyte* row = source->texture_pixels + (size_t) ys[j] * source_width * 3;
+		float row_sum[3] = {0, 0, 0};
+		for(i = 0; i < x_count; i++){
+			row_sum[0] += row[xs[i] * 3] * wx[i];
+			row_sum[1] += row[xs[i] * 3 + 1] * wx[i];
+			row_sum[2] += row[xs[i] * 3 + 2] * wx[i];
+		}
+		sum[0] += row_sum[0] * wy[j];
+		sum[1] += row_sum[1] * wy[j];
+		sum[2] += row_sum[2] * wy[j];
+	}
+	out[0] = clamp_byte(sum[0]);
+	out[1] = clamp_byte(sum[1]);
+	out[2] = clamp_byte(sum[2]);
+#endif
+}
+
+Contributions* filter_contributions(int filter, int source_size, int target_size){	//Weight table for one axis of a resize
+	Contributions* table = malloc(sizeof(Contributions));
+	float scale = (float) source_size / target_size;
+	float widen = scale > 1 ? scale : 1;	//Shrinking spreads the kernel over more source texels
+	int i, taps = 0;
+	int index[MAX_FILTER_TAPS];
+	float weight[MAX_FILTER_TAPS];
+	table->first = malloc(sizeof(int) * (target_size + 1));
+	table->index = NULL;
+	table->weight = NULL;
+	table->first[0] = 0;
+	for(i = 0; i < target_size; i++){
+		int count = filter_weights(filter, (i + 0.5f) * scale - 0.5f, widen, source_size, index, weight);
+		table->index = realloc(table->index, sizeof(int) * (taps + count));
+		table->weight = realloc(table->weight, sizeof(float) * (taps + count));
+		memcpy(table->index + taps, index, sizeof(int) * count);
+		memcpy(table->weight + taps, weight, sizeof(float) * count);
+		taps += count;
+		table->first[i + 1] = taps;
+	}
+	return table;
+}
+
+void free_contributions(Contributions* table){
+	free(table->first);
+	free(table->index);
+	free(table->weight);
+	free(table);
+}
+
+void resize_rows(void* arg, int band){	//Vertical pass for one band of output rows, horizontal pass on demand
+	ResizeJob* job = arg;
+	int target_width = job->target->width, row_floats = target_width * 3;
+	int row_stride = row_floats + 1;	//One float spare for the SIMD stores
+	int y_start = band * RESIZE_BAND, y_end = y_start + RESIZE_BAND, y, k;
+	float* ring = malloc(sizeof(float) * row_stride * job->ring_size);	//Horizontally filtered source rows
+	int* ring_row = malloc(sizeof(int) * job->ring_size);
+	if(ring == NULL || ring_row == NULL){
+		fprintf(stderr, "Error: Out of memory while resizing\n");
+		exit(1);
+	}
+	for(k = 0; k < job->ring_size; k++)
+		ring_row[k] = -1;
+	if(y_end > job->target->height) y_end = job->target->height;
+	
+	for(y = y_start; y < y_end; y++){
+		GLubyte* out = job->target->texture_pixels + (size_t) y * row_floats;
+		int first = job->rows->first[y], count = job->rows->first[y + 1] - first, tap;
+		const float* taps[MAX_FILTER_TAPS];
+		for(tap = 0; tap < count; tap++){	//Fetch or filter each source row this output row needs
+			int source_row = job->rows->index[first + tap];
+			float* filtered = ring + (size_t) (source_row % job->ring_size) * row_stride;
+			if(ring_row[source_row % job->ring_size] != source_row){
+				const GLubyte* in = job->source->texture_pixels + (size_t) source_row * (int) job->source->width * 3;
+				int x;
+				for(x = 0; x < target_width; x++){
+					int i, column_first = job->columns->first[x], column_end = job->columns->first[x + 1];
+#ifdef USE_SSE2
+					__m128 sum = _mm_setzero_ps();
+					for(i = column_first; i < column_end; i++)
+						sum = _mm_add_ps(sum, _mm_mul_ps(load_texel_ps(in + job->columns->index[i] * 3),
+															_mm_set1_ps(job->columns->weight[i])));
+					_mm_storeu_ps(filtered + x * 3, sum);	//Fourth lane is overwritten by the next pixel
+#else
+					float sum[3] = {0, 0, 0};
+					for(i = column_first; i < column_end; i++){
+						const GLubyte* texel = in + job->columns->index[i] * 3;
+						float w = job->columns->weight[i];
+						sum[0] += texel[0] * w;
+						sum[1] += texel[1] * w;
+						sum[2] += texel[2] * w;
+					}
+					filtered[x * 3] = sum[0];
+					filtered[x * 3 + 1] = sum[1];
+					filtered[x * 3 + 2] = sum[2];
+#endif
+				}
+				ring_row[source_row % job->ring_size] = source_row;
+			}
+			taps[tap] = filtered;
+		}
+		k = 0;
+#ifdef USE_SSE2
+		for(; k + 4 <= row_floats; k += 4){	//Four channels of the row at a time
+			__m128 sum = _mm_setzero_ps();
+			__m128i packed;
+			int bytes;
+			for(tap = 0; tap < count; tap++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(taps[tap] + k), _mm_set1_ps(job->rows->weight[first + tap])));
+			packed = _mm_cvtps_epi32(sum);
+			packed = _mm_packs_epi32(packed, packed);
+			packed = _mm_packus_epi16(packed, packed);
+			bytes = _mm_cvtsi128_si32(packed);
+			memcpy(out + k, &bytes, 4);
+		}
+#endif
+		for(; k < row_floats; k++){
+			float sum = 0;
+			for(tap = 0; tap < count; tap++)
+				sum += taps[tap][k] * job->rows->weight[first + tap];
+			out[k] = clamp_byte(sum);
+		}
+	}
+	free(ring);
+	free(ring_row);
+}
+
+Triple* resize_triple(Triple* source, int target_width, int target_height, int filter, int parallel){	//Separable resize
+	ResizeJob job;
+	Triple* target = malloc(sizeof(Triple));
+	int bands = (target_height + RESIZE_BAND - 1) / RESIZE_BAND, y, band;
+	target->width = target_width;
+	target->height = target_height;
+	target->texture_pixels = malloc((size_t) target_width * target_height * 3);
+	if(target->texture_pixels == NULL){
+		fprintf(stderr, "Error: Out of memory while resizing\n");
+		exit(1);
+	}
+	job.source = source;
+	job.target = target;
+	job.columns = filter_contributions(filter, source->width, target_width);
+	job.rows = filter_contributions(filter, source->height, target_height);
+	job.ring_size = 1;
+	for(y = 0; y < target_height; y++){	//Ring must hold every source row one output row reads
+		int count = job.rows->first[y + 1] - job.rows->first[y];
+		int span = job.rows->index[job.rows->first[y + 1] - 1] - job.rows->index[job.rows->first[y]] + 1;
+		if(count > job.ring_size) job.ring_size = count;
+		if(span > job.ring_size) job.ring_size = span;
+	}
+	if(parallel){
+		parallel_for(bands, resize_rows, &job);
+	}else{
+		for(band = 0; band < bands; band++)
+			resize_rows(&job, band);
+	}
+	free_contributions(job.columns);
+	free_contributions(job.rows);
+	return target;
+}
+//-------------------------------------
+
+Triple* halve_triple(Triple* src){	//Box filter an image down to half its size
+	int src_width = src->width, src_height = src->height;
+	int dst_width = src_width > 1 ? src_width / 2 : 1;
+	int dst_height = src_height > 1 ? src_height / 2 : 1;
+	int row_bytes = src_width * 3;
+	Triple* dst = malloc(sizeof(Triple));
+	GLubyte* row = malloc(row_bytes);	//Vertical average of the two source rows
+	int x, y, c, k;
+	
+	dst->width = dst_width;
+	dst->height = dst_height;
+	dst->texture_pixels = malloc((size_t) dst_width * dst_height * 3);
+	if(dst->texture_pixels == NULL || row == NULL){
+		fprintf(stderr, "Error: Out of memory while downscaling image\n");
+		exit(1);
+	}
+	
+	for(y = 0; y < dst_height; y++){
+		GLubyte* a = src->texture_pixels + (size_t) (2 * y) * row_bytes;
+		GLubyte* b = src->texture_pixels + (size_t) (2 * y + 1 < src_height ? 2 * y + 1 : 2 * y) * row_bytes;
+		GLubyte* out = dst->texture_pixels + (size_t) y * dst_width * 3;
+		k = 0;
+#ifdef USE_SSE2
+		for(; k + 16 <= row_bytes; k += 16){	//Average 16 channels of both rows at once
+			__m128i va = _mm_loadu_si128((const __m128i*) (a + k));
+			__m128i vb = _mm_loadu_si128((const __m128i*) (b + k));
+			_mm_storeu_si128((__m128i*) (row + k), _mm_avg_epu8(va, vb));
+		}
+#endif
+		for(; k < row_bytes; k++)
+			row[k] = (a[k] + b[k] + 1) >> 1;
+		for(x = 0; x < dst_width; x++){	//Then average horizontal pixel pairs
+			int x0 = 2 * x * 3;
+			int x1 = (2 * x + 1 < src_width ? 2 * x + 1 : 2 * x) * 3;
+			for(c = 0; c < 3; c++)
+				out[x * 3 + c] = (row[x0 + c] + row[x1 + c] + 1) >> 1;
+		}
+	}
+	free(row);
+	return dst;
+}
+
+void free_triple(Triple* texture_struct){	//Release an image and its pixels
+	if(texture_struct == NULL) return;
+	free(texture_struct->texture_pixels);
+	free(texture_struct);
+}
+
+int fits_budget(int tex_width, int tex_height){	//Check a texture size against the budget and the GL limits
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if(max_size > 0 && (tex_width > max_size || tex_height > max_size))
+		return 0;
+	return (size_t) tex_width * tex_height * 3 <= texture_budget;
+}
+
+GLuint new_texture(Triple* texture_struct){	//Put our image into a texture, downscaled if it would not fit
+	//Texture Setup -----------------------------
+	GLuint myTexture;
+	Triple* level_struct = texture_struct;
+	int level = 0;
+	long scope = trace_begin("gl", "new_texture");
+	
+	glGenTextures(1, &myTexture);	//Create new texture
+	cached_bind_texture(myTexture);	//Bind texture
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);	//Set type of texture filter
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);	//GL_LINEAR is used because pretty
-	glTexImage2D(GL_TEXTURE_2D,		//Add information to our texture
-					0, //No level of detail
-					GL_RGB, //FORMAT.. GL_RGB
-					texture_struct->width,
-					texture_struct->height,
-					0, //No border
-					GL_RGB,
-					GL_UNSIGNED_BYTE, //Whatever your numeric representation is
-					texture_struct->texture_pixels);	//Our pixel information
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	//Non power of two textures must clamp
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);	//Rows are tightly packed RGB, whatever the width
+	
+	while(1){
+		int full_width = texture_struct->width, full_height = texture_struct->height;
+		int next_level = level;
+		while(!fits_budget(full_width >> next_level > 1 ? full_width >> next_level : 1,
+				full_height >> next_level > 1 ? full_height >> next_level : 1) &&
+				(full_width >> next_level > 1 || full_height >> next_level > 1))	//Find the first level that fits
+			next_level++;
+		if(next_level > level && resample_filter >= FILTER_BICUBIC){	//Filter straight down to it in one pass
+			Triple* smaller = resize_triple(texture_struct,
+					full_width >> next_level > 1 ? full_width >> next_level : 1,
+					full_height >> next_level > 1 ? full_height >> next_level : 1, resample_filter, 1);
+			if(level_struct != texture_struct) free_triple(level_struct);
+			level_struct = smaller;
+			level = next_level;
+		}
+		while(level < next_level){	//Box filter one halving at a time
+			Triple* smaller = halve_triple(level_struct);
+			if(level_struct != texture_struct) free_triple(level_struct);
+			level_struct = smaller;
+			level++;
+		}
+		while(glGetError() != GL_NO_ERROR);	//Forget errors from earlier calls
+		glTexImage2D(GL_TEXTURE_2D,		//Add information to our texture
+						0, //No level of detail
+						GL_RGB, //FORMAT.. GL_RGB
+						level_struct->width,
+						level_struct->height,
+						0, //No border
+						GL_RGB,
+						GL_UNSIGNED_BYTE, //Whatever your numeric representation is
+						level_struct->texture_pixels);	//Our pixel information
+		if(glGetError() != GL_OUT_OF_MEMORY || (level_struct->width <= 1 && level_struct->height <= 1))
+			break;
+		//The driver could not hold this level after all, so shrink the budget and try the next one
+		texture_budget = (size_t) level_struct->width * level_struct->height * 3 / 4;
+	}
+	if(level > 0)
+		fprintf(stderr, "Note: %.0fx%.0f image exceeds the texture budget, showing a %.0fx%.0f level\n",
+				texture_struct->width, texture_struct->height, level_struct->width, level_struct->height);
+	
+	residency.full = texture_struct;	//Remember what was uploaded so detail can be paged in later
+	residency.texture = myTexture;
+	residency.level = level;
+	residency.level_width = level_struct->width;
+	residency.level_height = level_struct->height;
+	residency.detail_width = 0;
+	residency.texture_sampling = GL_LINEAR;
+	if(level_struct != texture_struct) free_triple(level_struct);
+	trace_end(scope);
+
+	return myTexture;	//Return texture descriptor
+	//-------------------------------------
+}
+
+float texel_magnification(int texture_width, int texture_height){	//Screen pixels per texel of a texture covering
+																	//the image, along the longer of its two axes
+	const float* m = view_transform.linear;
+	return fmaxf(sqrtf(m[0] * m[0] * width * width + m[1] * m[1] * height * height) / texture_width,
+				sqrtf(m[2] * m[2] * width * width + m[3] * m[3] * height * height) / texture_height);
+}
+
+void visible_region(int* x0, int* y0, int* x1, int* y1){	//Find the full resolution pixels the window can see
+	Affine inverse;
+	float corners[8] = {-1, -1, 1, -1, 1, 1, -1, 1};
+	float min_u = 1, min_v = 1, max_u = 0, max_v = 0;
+	int i;
+	
+	affine_invert(&inverse, &view_transform);
+	affine_apply_many(&inverse, corners, corners, 4);	//Map each window corner back onto the quad
+	for(i = 0; i < 4; i++){
+		float u = (corners[2 * i] + 1) / 2;	//Quad position to texture coordinate, see Vertices
+		float v = (1 - corners[2 * i + 1]) / 2;
+		if(u < min_u) min_u = u;
+		if(u > max_u) max_u = u;
+		if(v < min_v) min_v = v;
+		if(v > max_v) max_v = v;
+	}
+	if(min_u < 0) min_u = 0;
+	if(min_v < 0) min_v = 0;
+	if(max_u > 1) max_u = 1;
+	if(max_v > 1) max_v = 1;
+	*x0 = (int) floorf(min_u * residency.full->width);
+	*y0 = (int) floorf(min_v * residency.full->height);
+	*x1 = (int) ceilf(max_u * residency.full->width);
+	*y1 = (int) ceilf(max_v * residency.full->height);
+}
+
+void page_detail(){	//Upload full resolution pixels for the visible region once the base level is magnified
+	int full_width, full_height, x0, y0, x1, y1, region_width, region_height, y;
+	size_t base_bytes = (size_t) residency.level_width * residency.level_height * 3, detail_budget;
+	float magnification;
+	GLubyte* region;
+	Vertex quad[4];
+	
+	if(residency.level == 0 || residency.full == NULL) return;	//Nothing was downscaled
+	
+	magnification = texel_magnification(residency.level_width, residency.level_height);
+	if(magnification <= 1){	//The base level already has more texels than the screen shows
+		residency.detail_width = 0;
+		return;
+	}
+	
+	full_width = residency.full->width;
+	full_height = residency.full->height;
+	visible_region(&x0, &y0, &x1, &y1);
+	if(x1 <= x0 || y1 <= y0){	//Image is off screen
+		residency.detail_width = 0;
+		return;
+	}
+	if(residency.detail_width > 0 && x0 >= residency.detail_x && y0 >= residency.detail_y &&
+			x1 <= residency.detail_x + residency.detail_width &&
+			y1 <= residency.detail_y + residency.detail_height)
+		return;	//Already paged in
+	
+	//Page in a margin around the view so small pans do not upload again
+	detail_budget = texture_budget > base_bytes ? texture_budget - base_bytes : 0;	//The base level stays resident
+	region_width = (x1 - x0) * 3 / 2;
+	region_height = (y1 - y0) * 3 / 2;
+	while((!fits_budget(region_width, region_height) || (size_t) region_width * region_height * 3 > detail_budget) &&
+			region_width > 1 && region_height > 1){
+		region_width = region_width * 7 / 8;	//Keep the view centre sharp, edges stay on the base level
+		region_height = region_height * 7 / 8;
+	}
+	if((size_t) region_width * region_height * 3 > detail_budget){	//No room left beside the base level
+		residency.detail_width = 0;
+		return;
+	}
+	if(region_width > full_width) region_width = full_width;
+	if(region_height > full_height) region_height = full_height;
+	x0 = (x0 + x1 - region_width) / 2;
+	y0 = (y0 + y1 - region_height) / 2;
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x0 + region_width > full_width) x0 = full_width - region_width;
+	if(y0 + region_height > full_height) y0 = full_height - region_height;
+	
+	region = malloc((size_t) region_width * region_height * 3);	//GLES2 cannot upload a sub-rectangle directly
+	if(region == NULL) return;
+	for(y = 0; y < region_height; y++)
+		memcpy(region + (size_t) y * region_width * 3,
+				residency.full->texture_pixels + ((size_t) (y0 + y) * full_width + x0) * 3,
+				(size_t) region_width * 3);
+	
+	if(residency.detail_texture == 0){
+		glGenTextures(1, &residency.detail_texture);
+		glGenBuffers(1, &residency.detail_buffer);
+	}
+	cached_bind_texture(residency.detail_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	while(glGetError() != GL_NO_ERROR);	//Forget errors from earlier calls
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, region_width, region_height, 0, GL_RGB, GL_UNSIGNED_BYTE, region);
+	free(region);
+	if(glGetError() == GL_OUT_OF_MEMORY){	//The driver could not hold it after all, so shrink the budget like
+		texture_budget = base_bytes + (size_t) region_width * region_height * 3 / 4;	//new_texture() does and try a
+		residency.detail_width = 0;														//smaller region next frame
+		needs_redraw = 1;
+		return;
+	}
+	residency.detail_sampling = GL_LINEAR;
+	
+	memcpy(quad, Vertices, sizeof(quad));	//Same layout as the full quad, shrunk to the region
+	quad[0].position[0] = quad[3].position[0] = -1 + 2.f * x0 / full_width;
+	quad[1].position[0] = quad[2].position[0] = -1 + 2.f * (x0 + region_width) / full_width;
+	quad[0].position[1] = quad[1].position[1] = 1 - 2.f * y0 / full_height;
+	quad[2].position[1] = quad[3].position[1] = 1 - 2.f * (y0 + region_height) / full_height;
+	cached_bind_buffer(GL_ARRAY_BUFFER, residency.detail_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_DYNAMIC_DRAW);
+	
+	residency.detail_x = x0;
+	residency.detail_y = y0;
+	residency.detail_width = region_width;
+	residency.detail_height = region_height;
+}
+
+GLuint bind_buffer(){	//Create new buffer, bind, and send it
+	GLuint vertex_buffer;
+	GLuint index_buffer;
+	// Create Buffer
+	glGenBuffers(1, &vertex_buffer);
+
+	// Map GL_ARRAY_BUFFER to this buffer
+	cached_bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+
+	// Send the data
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertices), Vertices, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &index_buffer);
+	cached_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Indices), Indices, GL_STATIC_DRAW);
+	quad_index_buffer = index_buffer;
+	return vertex_buffer;	//Return vertex buffer so it can be rebound after drawing other quads
+}
+
+void set_vertex_attributes(VariableArray* our_variables){	//Point shader attributes at the bound vertex buffer
+	glVertexAttribPointer(our_variables->position_slot,	//Send position information to vertex shader
+							  3,
+							  GL_FLOAT,
+							  GL_FALSE,
+							  sizeof(Vertex),
+							  0);
+	glVertexAttribPointer(our_variables->color_slot,	//Send color information to vertex shader
+							  4,
+							  GL_FLOAT,
+							  GL_FALSE,
+							  sizeof(Vertex),
+							  (GLvoid*) (sizeof(float) * 3));
+	glVertexAttribPointer(our_variables->texture_slot,	//Send texture information to vertex shader
+							  2,
+							  GL_FLOAT,
+							  GL_FALSE,
+							  sizeof(Vertex),
+							  (GLvoid*) (sizeof(float) * 7));
+}
+
+void draw_quad(GLuint vertex_buffer, GLuint texture, VariableArray* our_variables){	//Draw one textured quad
+	cached_bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+	if(!state_unchanged(gl_state.attribute_buffer == vertex_buffer)){	//Pointers still refer to this buffer otherwise
+		set_vertex_attributes(our_variables);
+		gl_state.attribute_buffer = vertex_buffer;
+	}
+	cached_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);	//The contact sheet binds its own
+	cached_bind_texture(texture);
+	note_gl_call();
+	glDrawElements(GL_TRIANGLES,	//Draw everything
+				   sizeof(Indices) / sizeof(GLubyte),
+				   GL_UNSIGNED_BYTE, 0);
+}
+
+VariableArray* get_shader_variables(GLint program_id){	//Retrieve shader variable locations
+	VariableArray* our_variables = malloc(sizeof(VariableArray));
+	our_variables->program_id = program_id;
+	our_variables->mvp_slot = glGetUniformLocation(program_id, "MVP");
+	if(our_variables->mvp_slot == -1){	//If variable does not exist in shader, throw error
+		fprintf(stderr, "Error: Could not find MVP matrix");
+		exit(1);
+	}
+	our_variables->position_slot = glGetAttribLocation(program_id, "Position");
+	if(our_variables->position_slot == -1){
+		fprintf(stderr, "Error: Could not find position vector");
+		exit(1);
+	}
+	our_variables->color_slot = ATTRIBUTE_COLOR;	//Unused by the fragment shader, so some drivers (Mesa) optimize it
+													//out, but it was bound to this location
+	our_variables->texture_slot = glGetAttribLocation(program_id, "TexCoordIn");
+	if(our_variables->texture_slot == -1){
+		fprintf(stderr, "Error: Could not find texture coordinates");
+		exit(1);
+	}
+	
+	glEnableVertexAttribArray(our_variables->position_slot);	//Enable attribute variables
+	glEnableVertexAttribArray(our_variables->color_slot);
+	glEnableVertexAttribArray(our_variables->texture_slot);
+	
+	our_variables->textureUniform = glGetUniformLocation(program_id, "Texture");
+	if(our_variables->textureUniform == -1){
+		fprintf(stderr, "Error: Could not find texture uniform");
+		exit(1);
+	}
+	our_variables->texture_size_slot = glGetUniformLocation(program_id, "TextureSize");	//Only filtered shaders have it
+	our_variables->grid_width_slot = glGetUniformLocation(program_id, "GridWidth");
+	return our_variables;	//Return struct of all variable locations
+}
+
+VariableArray* use_filter(int filter){	//Make the program for a filter current, building it the first time
+	if(filter_variables[filter] == NULL){	//Nearest and bilinear share the plain program from setup_renderer()
+		char* source = malloc(strlen(filtered_fragment_src) + 64);
+		GLint program_id;
+		sprintf(source, "#define FILTER_RADIUS %d\n#define LANCZOS %d\n%s", filter == FILTER_LANCZOS3 ? 3 : 2,
+				filter == FILTER_LANCZOS3, filtered_fragment_src);
+		program_id = simple_program(source);
+		free(source);
+		cached_use_program(program_id);
+		filter_variables[filter] = get_shader_variables(program_id);
+		glUniform1i(filter_variables[filter]->textureUniform, 0);
+	}
+	cached_use_program(filter_variables[filter]->program_id);
+	return filter_variables[filter];
+}
+
+VariableArray* use_grid(float grid_width){	//use_filter() for the pixel grid program
+	if(grid_variables == NULL){
+		GLint program_id = simple_program(grid_fragment_src);
+		cached_use_program(program_id);
+		grid_variables = get_shader_variables(program_id);
+		glUniform1i(grid_variables->textureUniform, 0);
+	}
+	cached_use_program(grid_variables->program_id);
+	note_gl_call();
+	glUniform1f(grid_variables->grid_width_slot, grid_width);
+	return grid_variables;
+}
+
+void set_sampling(GLuint texture, GLint* current, GLint sampling){	//Change a texture's GL filter if it differs
+	cached_bind_texture(texture);
+	if(state_unchanged(*current == sampling)) return;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampling);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampling);
+	*current = sampling;
+}
+
+void set_texture_size(VariableArray* our_variables, int tex_width, int tex_height){	//For the filtered shaders
+	if(our_variables->texture_size_slot == -1) return;
+	note_gl_call();
+	glUniform2f(our_variables->texture_size_slot, tex_width, tex_height);
+}
+
+#define DECODE_BUFFER 65536	//Bytes read_p3_fast() parses per read
+
+volatile long decode_allocations = 0;	//Heap blocks the decoders have asked for, --benchmark decode reports it
+
+void* counted_malloc(size_t size){	//malloc() for the decoders, counted and checked
+	void* block = malloc(size);
+	if(block == NULL)
+		decode_error("Error: Out of memory decoding an image\n");
+	atomic_increment(&decode_allocations);
+	return block;
+}
+
+Triple* read_p3_file(FILE* ppm){	//Read p3 file and store in GLubyte array
+	double width, height, alpha;
+	Triple* texture_struct = counted_malloc(sizeof(Triple));
+	int i, j;
+	GLubyte* texture_pixels;
+	long scope = trace_begin("load", "parse header");
+	
+	skip_comts_ws(ppm);	//Skip comments and whitespace at the beginning of the file
+	width = next_number(ppm);	//Grab width value
+	
+	skip_comts_ws(ppm);	//Skip more comments and whitespace
+	height = next_number(ppm);	//Grab height value
+	
+	texture_struct->width = width;	//Store width and height into our struct
+	texture_struct->height = height;
+	texture_pixels = counted_malloc(sizeof(GLubyte) * width * height * 3);
+	
+	skip_comts_ws(ppm);	//You know what this does
+	if((alpha = next_number(ppm)) != 255){	//Grab alpha value, make sure it is valid
+		decode_error("Error: Incorrect alpha value at line %d\n", line);
+	}
+	skip_comts_ws(ppm);
+	trace_end(scope);
+	
+	scope = trace_begin("load", "decode raster");
+	for(i = 0; i < height; i++){	//Iterate through file and store pixel info into GLubyte array
+		for(j = 0; j < width; j++){
+			texture_pixels[(size_t)(j + width * i) * 3] = (int) next_number(ppm);
+			skip_ws(ppm);
+			texture_pixels[(size_t)(j + width * i) * 3 + 1] = (int) next_number(ppm);
+			skip_ws(ppm);
+			texture_pixels[(size_t)(j + width * i) * 3 + 2] = (int) next_number(ppm);
+			if(i == height - 1 && j == width - 1) continue;	//The file may end right after the last value
+			skip_ws(ppm);
+		}
+	}
+	trace_end(scope);
+	texture_struct->texture_pixels = texture_pixels;	//Store GLubyte array into struct
+	return texture_struct;	//return struct
+}
+
+Triple* read_p6_file(FILE* ppm){	//Read p6 file and store in GLubyte array
+	double width, height, alpha;
+	Triple* texture_struct = counted_malloc(sizeof(Triple));
+	int i, j, c;
+	GLubyte* texture_pixels;
+	long scope = trace_begin("load", "parse header");
+	
+	skip_comts_ws(ppm);	//Skip comments and whitespace
+	width = next_number(ppm);	//Grab width value
+	
+	skip_comts_ws(ppm);
+	height = next_number(ppm);	//Grab height value
+	
+	texture_struct->width = width;	//Store width and height values into struct
+	texture_struct->height = height;
+	texture_pixels = counted_malloc(sizeof(GLubyte) * width * height * 3);
+	
+	skip_comts_ws(ppm);
+	if((alpha = next_number(ppm)) != 255){	//Grab alpha value and error check it
+		decode_error("Error: Incorrect alpha value at line %d\n", line);
+	}
+	if(!isspace(next_c(ppm))){	//There must be exactly one whitespace between header and raw info
+		decode_error("Error: There must be one whitespace after the alpha field, line %d\n", line);
+	}
+	trace_end(scope);
+	
+	scope = trace_begin("load", "decode raster");
+	for(i = 0; i < height; i++){	//Iterate through file and store pixel info into GLubyte array
+		for(j = 0; j < width; j++){
+			texture_pixels[(size_t)(j + width * i) * 3] = next_c(ppm);
+			texture_pixels[(size_t)(j + width * i) * 3 + 1] = next_c(ppm);
+			texture_pixels[(size_t)(j + width * i) * 3 + 2] = next_c(ppm);
+		}
+	}
+	trace_end(scope);
+	
+	texture_struct->texture_pixels = texture_pixels;	//Store GLubyte array into struct
+	return texture_struct;	//return struct
+}
+
+Triple* read_ppm_header(FILE* ppm, int raw){	//The rest of a P3 or P6 header after the magic number, with
+	Triple* texture_struct = counted_malloc(sizeof(Triple));		//the pixels allocated for the raster
+	begin_decode_scope("parse header");
+	
+	texture_struct->texture_pixels = NULL;
+	decode_partial = texture_struct;	//Freed by try_read_ppm_file() if anything below fails
+	skip_comts_ws(ppm);
+	texture_struct->width = next_number(ppm);
+	skip_comts_ws(ppm);
+	texture_struct->height = next_number(ppm);
+	check_image_size(texture_struct->width, texture_struct->height);
+	skip_comts_ws(ppm);
+	if(next_number(ppm) != 255)
+		decode_error("Error: Incorrect alpha value at line %d\n", line);
+	if(!raw)
+		skip_comts_ws(ppm);
+	else if(!isspace(next_c(ppm)))	//There must be exactly one whitespace between header and raw info
+		decode_error("Error: There must be one whitespace after the alpha field, line %d\n", line);
+	texture_struct->texture_pixels = counted_malloc((size_t) texture_struct->width * texture_struct->height * 3);
+	end_decode_scope();
+	return texture_struct;
+}
+
+Triple* read_p3_fast(FILE* ppm){	//read_p3_file() parsing digits out of large reads instead of a fscanf per value
+	unsigned char buffer[DECODE_BUFFER];
+	Triple* texture_struct = read_ppm_header(ppm, 0);
+	GLubyte* texture_pixels = texture_struct->texture_pixels;
+	size_t count = (size_t) texture_struct->width * texture_struct->height * 3, position = 0, length = 0, i;
+	begin_decode_scope("decode raster");
+	
+	for(i = 0; i < count; i++){
+		unsigned value = 0;
+		int digits = 0;
+		while(1){	//Whitespace, then digits up to whatever follows them
+			int c;
+			if(position == length){
+				length = fread(buffer, 1, sizeof(buffer), ppm);
+				position = 0;
+				if(length == 0) break;
+			}
+			c = buffer[position];
+			if(c >= '0' && c <= '9'){
+				value = value * 10 + (c - '0');
+				digits++;
+			}else if(digits > 0)
+				break;
+			else if(c == '\n')
+				line++;
+			else if(c != ' ' && (c < '\t' || c > '\r'))	//The C locale's isspace()
+				decode_error("Error: Expected number at line %d\n", line);
+			position++;
+		}
+		if(digits == 0)
+			decode_error("Error: Unexpected end of file on line number %d.\n", line);
+		texture_pixels[i] = (GLubyte) value;	//Wraps above 255 like the cast in read_p3_file()
+	}
+	end_decode_scope();
+	return texture_struct;
+}
+
+Triple* read_p6_fast(FILE* ppm){	//read_p6_file() with the raster read in one call
+	Triple* texture_struct = read_ppm_header(ppm, 1);
+	size_t size = (size_t) texture_struct->width * texture_struct->height * 3;
+	begin_decode_scope("decode raster");
+	
+	if(fread(texture_struct->texture_pixels, 1, size, ppm) != size)
+		decode_error("Error: Unexpected end of file on line number %d.\n", line);
+	end_decode_scope();
+	return texture_struct;
+}
+
+Triple* decode_ppm(FILE* inputFile){	//Figure out type of file, and call read_p3_fast or read_p6_fast
+	Triple* texture_struct = NULL;
+	line = 1;	//Counted per file, this thread may have decoded others before
+	skip_comts_ws(inputFile);	//Skip comments and whitespace
+	expect_c(inputFile, 'P');	//Expect a P
+	int c = next_c(inputFile);	//Get next magic number
+	if(c == '3'){				//If three, call our p3 function
+		texture_struct = read_p3_fast(inputFile);
+	}else if(c == '6'){			//If six, call our p6 function
+		texture_struct = read_p6_fast(inputFile);
+	}else{						//Else, invalid file
+		decode_error("Error: Incorrect ppm file number on line %d\n", line);
+	}
+	decode_partial = NULL;
+	return texture_struct;
+}
+
+Triple* read_ppm_file(char* inputName){	//Read a whole image, any problem with the file ends the program
+	Triple* texture_struct;
+	long scope = trace_begin("load", "read_ppm_file");
+	FILE* inputFile = fopen(inputName, "rb");	//Open input file
+	if(inputFile == NULL){	//If file does not exist, throw error
+		fprintf(stderr, "Error: File does not exist\n");
+		exit(1);
+	}
+	texture_struct = decode_ppm(inputFile);
+	fclose(inputFile);	//Close file
+	trace_end(scope);
+	return texture_struct;	//Return struct containing image information
+}
+
+int try_read_ppm_size(char* inputName, int* image_width, int* image_height){	//Only the size from the header,
+	FILE* inputFile = fopen(inputName, "rb");									//0 after reporting a bad file
+	jmp_buf recovery;
+	int found;
+	if(inputFile == NULL){
+		fprintf(stderr, "Error: Could not open %s\n", inputName);
+		return 0;
+	}
+	if(setjmp(recovery) == 0){
+		double header_width, header_height;
+		int c;
+		decode_recovery = &recovery;
+		line = 1;
+		skip_comts_ws(inputFile);
+		expect_c(inputFile, 'P');
+		c = next_c(inputFile);
+		if(c != '3' && c != '6')
+			decode_error("Error: Incorrect ppm file number on line %d\n", line);
+		skip_comts_ws(inputFile);
+		header_width = next_number(inputFile);
+		skip_comts_ws(inputFile);
+		header_height = next_number(inputFile);
+		check_image_size(header_width, header_height);
+		*image_width = (int) header_width;
+		*image_height = (int) header_height;
+		found = 1;
+	}else{
+		fprintf(stderr, "Warning: Could not decode %s\n", inputName);
+		found = 0;
+	}
+	decode_recovery = NULL;
+	fclose(inputFile);
+	return found;
+}
+
+Triple* try_read_ppm_file(char* inputName){	//read_ppm_file() for worker threads, NULL after reporting a
+	Triple* texture_struct = NULL;			//missing or malformed file instead of exiting
+	FILE* inputFile = fopen(inputName, "rb");
+	jmp_buf recovery;
+	long scope;
+	if(inputFile == NULL){
+		fprintf(stderr, "Error: Could not open %s\n", inputName);
+		return NULL;
+	}
+	scope = trace_begin("load", "read_ppm_file");
+	if(setjmp(recovery) == 0){
+		decode_recovery = &recovery;
+		texture_struct = decode_ppm(inputFile);
+	}else{	//decode_error() has already said what was wrong
+		fprintf(stderr, "Warning: Could not decode %s\n", inputName);
+		end_decode_scope();	//The phase that failed, read_ppm_file below
+		free_triple(decode_partial);
+		decode_partial = NULL;
+		texture_struct = NULL;
+	}
+	decode_recovery = NULL;
+	fclose(inputFile);
+	trace_end(scope);
+	return texture_struct;
+}
+
+Triple* placeholder_image(){	//Stands in for a file that could not be decoded, a small dark grey square
+	Triple* image = malloc(sizeof(Triple));
+	image->width = image->height = 2;
+	image->texture_pixels = malloc(2 * 2 * 3);
+	memset(image->texture_pixels, 64, 2 * 2 * 3);
+	return image;
+}
+
+//Frame metrics -----------------------------
+
+void init_metrics(){	//Look up the timer query extension, it is optional
+	const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+	if(extensions == NULL || strstr(extensions, "GL_EXT_disjoint_timer_query") == NULL)
+		return;
+	glGenQueriesEXT_ = (PFNGLGENQUERIESEXTPROC) eglGetProcAddress("glGenQueriesEXT");
+	glBeginQueryEXT_ = (PFNGLBEGINQUERYEXTPROC) eglGetProcAddress("glBeginQueryEXT");
+	glEndQueryEXT_ = (PFNGLENDQUERYEXTPROC) eglGetProcAddress("glEndQueryEXT");
+	glGetQueryObjectuivEXT_ = (PFNGLGETQUERYOBJECTUIVEXTPROC) eglGetProcAddress("glGetQueryObjectuivEXT");
+	glGetQueryObjectui64vEXT_ = (PFNGLGETQUERYOBJECTUI64VEXTPROC) eglGetProcAddress("glGetQueryObjectui64vEXT");
+	if(!glGenQueriesEXT_ || !glBeginQueryEXT_ || !glEndQueryEXT_ || !glGetQueryObjectuivEXT_ || !glGetQueryObjectui64vEXT_)
+		return;
+	glGenQueriesEXT_(QUERY_COUNT, gpu_queries);
+	gpu_timer = 1;
+}
+
+void start_metrics_file(FILE* file){	//Per frame rows go to file from now on
+	metrics_file = file;
+	fprintf(metrics_file, "frame,cpu_ms,swap_ms,latency_ms,gpu_ms,gl_calls,gl_skipped\n");
+}
+
+void write_metrics_row(long frame){	//Append one finished frame to the CSV file
+	FrameMetrics* metrics = &frame_history[frame % FRAME_HISTORY];
+	if(metrics_file == NULL) return;
+	fprintf(metrics_file, "%ld,%.3f,%.3f,%.3f,%.3f,%d,%d\n", frame, metrics->cpu, metrics->swap, metrics->latency,
+			metrics->gpu, metrics->gl_calls, metrics->gl_skipped);
+}
+
+void collect_gpu_times(){	//Pick up timer query results that are ready, oldest first
+	GLint disjoint = 0;
+	if(gpu_timer){
+		glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);	//Results are garbage after a disjoint event
+		while(gpu_pending < frame_count){
+			GLuint available = 0;
+			GLuint64 elapsed = 0;
+			GLuint query = gpu_queries[gpu_pending % QUERY_COUNT];
+			if(frame_count - gpu_pending < QUERY_COUNT){	//Wait for the driver unless the query is about to be reused
+				glGetQueryObjectuivEXT_(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+				if(!available) break;
+			}
+			glGetQueryObjectui64vEXT_(query, GL_QUERY_RESULT_EXT, &elapsed);
+			frame_history[gpu_pending % FRAME_HISTORY].gpu = disjoint ? -1 : elapsed / 1e6;
+			write_metrics_row(gpu_pending++);
+		}
+	}else{
+		while(gpu_pending < frame_count)
+			write_metrics_row(gpu_pending++);
+	}
+}
+
+void begin_frame_metrics(){	//Start timing a frame, call before the first draw
+	FrameMetrics* metrics = &frame_history[frame_count % FRAME_HISTORY];
+	collect_gpu_times();
+	frame_start = now_seconds();
+	metrics->gpu = -1;
+	gl_state.calls_issued = 0;
+	gl_state.calls_skipped = 0;
+	if(gpu_timer)
+		glBeginQueryEXT_(GL_TIME_ELAPSED_EXT, gpu_queries[frame_count % QUERY_COUNT]);
+}
+
+void end_frame_metrics(double swap_start, double swap_end){	//Finish timing a frame, call after the swap
+	FrameMetrics* metrics = &frame_history[frame_count % FRAME_HISTORY];
+	metrics->cpu = (swap_start - frame_start) * 1000;
+	metrics->swap = (swap_end - swap_start) * 1000;
+	metrics->latency = input_time > 0 ? (swap_end - input_time) * 1000 : -1;
+	metrics->gl_calls = gl_state.calls_issued;
+	metrics->gl_skipped = gl_state.calls_skipped;
+	input_time = 0;
+	frame_count++;
+	if(!gpu_timer)
+		collect_gpu_times();
+}
+
+void end_gpu_timer(){	//Stop the GPU timer, call right after the last draw of the frame
+	if(gpu_timer)
+		glEndQueryEXT_(GL_TIME_ELAPSED_EXT);
+}
+
+void finish_metrics(){	//Flush frames still waiting on the GPU and close the CSV file
+	if(gpu_timer)
+		glFinish();
+	while(gpu_pending < frame_count - QUERY_COUNT)
+		collect_gpu_times();
+	collect_gpu_times();
+	if(metrics_file != NULL && metrics_file != stdout)
+		fclose(metrics_file);
+	metrics_file = NULL;
+}
+
+void average_metrics(FrameMetrics* average){	//Average the recent frames for display
+	int i, n = frame_count < FRAME_HISTORY ? frame_count : FRAME_HISTORY;
+	int latency_frames = 0, gpu_frames = 0;
+	memset(average, 0, sizeof(FrameMetrics));
+	for(i = 0; i < n; i++){
+		FrameMetrics* metrics = &frame_history[(frame_count - 1 - i) % FRAME_HISTORY];
+		average->cpu += metrics->cpu / n;
+		average->swap += metrics->swap / n;
+		if(metrics->latency >= 0){
+			average->latency += metrics->latency;
+			latency_frames++;
+		}
+		if(metrics->gpu >= 0){
+			average->gpu += metrics->gpu;
+			gpu_frames++;
+		}
+	}
+	average->latency = latency_frames ? average->latency / latency_frames : -1;
+	average->gpu = gpu_frames ? average->gpu / gpu_frames : -1;
+}
+
+void overlay_text(GLubyte* pixels, int tex_width, int row, const char* text){	//Stamp text into an RGB raster
+	int col, x, y;
+	for(col = 0; text[col] != '\0' && col < (tex_width - 1) / 4; col++){	//Clip at the right edge
+		const char* found = strchr(font_chars, toupper((unsigned char) text[col]));
+		unsigned short glyph;
+		if(text[col] == ' ' || found == NULL) continue;
+		glyph = font_glyphs[found - font_chars];
+		for(y = 0; y < 5; y++)
+			for(x = 0; x < 3; x++)
+				if(glyph & (1 << (14 - y * 3 - x)))
+					memset(pixels + ((size_t) (row * 6 + 1 + y) * tex_width + col * 4 + 1 + x) * 3, 255, 3);
+	}
+}
+
+void format_ms(char* out, const char* label, double value){	//One overlay line, or a dash if unknown
+	if(value < 0)
+		snprintf(out, OVERLAY_COLUMNS + 1, "%-5s -", label);
+	else
+		snprintf(out, OVERLAY_COLUMNS + 1, "%-5s%6.2f MS", label, value);
+}
+
+void draw_overlay(VariableArray* our_variables){	//Draw the recent frame metrics in the top left corner
+	char lines[OVERLAY_LINES][OVERLAY_COLUMNS + 1];
+	GLubyte pixels[OVERLAY_WIDTH * OVERLAY_HEIGHT * 3];
+	FrameMetrics average;
+	Vertex quad[4];
+	mat4x4 identity;
+	float right, bottom;
+	int i;
+	
+	average_metrics(&average);
+	format_ms(lines[0], "CPU", average.cpu);
+	format_ms(lines[1], "SWAP", average.swap);
+	format_ms(lines[2], "LAT", average.latency);
+	format_ms(lines[3], "GPU", gpu_timer ? average.gpu : -1);
+	snprintf(lines[4], OVERLAY_COLUMNS + 1, "GL   %3d SKIP %d", frame_history[(frame_count + FRAME_HISTORY - 1) % FRAME_HISTORY].gl_calls,
+			frame_history[(frame_count + FRAME_HISTORY - 1) % FRAME_HISTORY].gl_skipped);
+	snprintf(lines[5], OVERLAY_COLUMNS + 1, "R%6.1f S%7.3f", view.angle * 180 / (float) M_PI, view.scale);
+	memset(pixels, 32, sizeof(pixels));	//Dark backdrop keeps text readable over any image
+	for(i = 0; i < OVERLAY_LINES; i++)
+		overlay_text(pixels, OVERLAY_WIDTH, i, lines[i]);
+	
+	if(overlay_texture == 0){
+		glGenTextures(1, &overlay_texture);
+		glGenBuffers(1, &overlay_buffer);
+		cached_bind_texture(overlay_texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);	//Keep the font blocky when scaled
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	cached_bind_texture(overlay_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, OVERLAY_WIDTH, OVERLAY_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+	
+	right = -1 + 2.f * OVERLAY_WIDTH * OVERLAY_SCALE / width;	//Pixel sized quad in the top left corner
+	bottom = 1 - 2.f * OVERLAY_HEIGHT * OVERLAY_SCALE / height;
+	memcpy(quad, Vertices, sizeof(quad));
+	quad[1].position[0] = quad[2].position[0] = right;
+	quad[2].position[1] = quad[3].position[1] = bottom;
+	cached_bind_buffer(GL_ARRAY_BUFFER, overlay_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_DYNAMIC_DRAW);
+	
+	mat4x4_identity(identity);	//Overlay ignores the image transform
+	cached_use_program(our_variables->program_id);
+	cached_uniform_matrix(our_variables->mvp_slot, (const GLfloat*) identity);
+	draw_quad(overlay_buffer, overlay_texture, our_variables);
+}
+//-------------------------------------
+
+int try_write_ppm_file(char* outputName, Triple* texture_struct){	//Write an image out as a binary P6 file,
+	FILE* outputFile = fopen(outputName, "wb");							//returns 0 after reporting a failure
+	size_t size = (size_t) texture_struct->width * (size_t) texture_struct->height * 3;
+	int written;
+	if(outputFile == NULL){
+		fprintf(stderr, "Error: Could not open %s for writing\n", outputName);
+		return 0;
+	}
+	fprintf(outputFile, "P6\n%d %d\n255\n", (int) texture_struct->width, (int) texture_struct->height);
+	written = fwrite(texture_struct->texture_pixels, 1, size, outputFile) == size;
+	if(fclose(outputFile) != 0 || !written){	//A full disk may only show when the buffer is flushed
+		fprintf(stderr, "Error: Could not write %s\n", outputName);
+		return 0;
+	}
+	return 1;
+}
+
+void write_ppm_file(char* outputName, Triple* texture_struct){	//try_write_ppm_file() that exits on failure
+	if(!try_write_ppm_file(outputName, texture_struct))
+		exit(1);
+}
+
+void pick_window_size(Triple* texture_struct){	//Grow the image by half steps until it fills a good part of the screen
+	width = texture_struct->width;
+	height = texture_struct->height;
+	while(width < 1400 && height < 750){
+		width += texture_struct->width/2;
+		height += texture_struct->height/2;
+	}
+	width -= texture_struct->width/2;
+	height -= texture_struct->height/2;
+}
+
+VariableArray* setup_renderer(Triple* texture_struct, GLuint* myTexture, GLuint* vertex_buffer){	//GL setup shared by every mode
+	GLint program_id;
+	VariableArray* our_variables;
+	
+	//Texture Setup -----------------------------
+	*myTexture = new_texture(texture_struct);
+	startup_mark(STARTUP_UPLOAD);
+
+	program_id = simple_program(fragment_shader_src);	//Set up program
+	startup_mark(STARTUP_SHADERS);
+
+	cached_use_program(program_id);	//Use program
+	
+	our_variables = get_shader_variables(program_id);	//Get shader variable locations
+	filter_variables[FILTER_NEAREST] = filter_variables[FILTER_BILINEAR] = our_variables;	//GL filters the plain program
+	
+	*vertex_buffer = bind_buffer();	//Create, bind, and send buffer
+	
+	glActiveTexture(GL_TEXTURE0);	//Make texture active
+	glUniform1i(our_variables->textureUniform, 0);	//Get ready to use texture information retrieved from fragment shader
+	
+	init_metrics();	//Find the GPU timer, if the driver has one
+	return our_variables;
+}
+
+VariableArray* pick_sampling(int texture_width, int texture_height, GLint* sampling){	//Program and GL filter for
+																						//a texture at this zoom
+	float magnification = texel_magnification(texture_width, texture_height);
+	if(magnify_nearest && magnification >= NEAREST_MAGNIFICATION){	//Texels are blocks on screen, show them exactly
+		*sampling = GL_NEAREST;
+		if(pixel_grid && magnification >= GRID_MAGNIFICATION)
+			return use_grid(1 / magnification);
+		return use_filter(FILTER_NEAREST);
+	}
+	*sampling = resample_filter == FILTER_BILINEAR ? GL_LINEAR : GL_NEAREST;	//Shaders filter the others
+	return use_filter(resample_filter);
+}
+
+void render_frame(GLuint vertex_buffer, GLuint myTexture, VariableArray* our_variables){	//Draw everything for one frame
+	VariableArray* image_variables;
+	GLint sampling;
+	int image_width, image_height;
+	
+	update_mvp();
+	cached_clear_color(0, 104.0/255.0, 55.0/255.0, 1.0);	//Clear window color
+	note_gl_call();
+	glClear(GL_COLOR_BUFFER_BIT);
+	
+	page_detail();	//Swap in full resolution pixels if a downscaled level is being magnified
+	image_variables = pick_sampling(residency.level_width, residency.level_height, &sampling);
+	cached_uniform_matrix(image_variables->mvp_slot, (const GLfloat*) mvp);	//Send transform. matrix to vertex shader
+	set_sampling(myTexture, &residency.texture_sampling, sampling);
+	set_texture_size(image_variables, residency.level_width, residency.level_height);
+	draw_quad(vertex_buffer, myTexture, image_variables);
+	if(residency.detail_width > 0){	//Sharper region on top of the downscaled level
+		image_size(&image_width, &image_height);
+		image_variables = pick_sampling(image_width, image_height, &sampling);
+		cached_uniform_matrix(image_variables->mvp_slot, (const GLfloat*) mvp);
+		set_sampling(residency.detail_texture, &residency.detail_sampling, sampling);
+		set_texture_size(image_variables, residency.detail_width, residency.detail_height);
+		draw_quad(residency.detail_buffer, residency.detail_texture, image_variables);
+	}
+	if(show_overlay)
+		draw_overlay(our_variables);
+	end_gpu_timer();
+}
+
+//Software rendering -----------------------------
+
+static unsigned int fetch_texel(const GLubyte* pixels, int source_width, int x, int y){	//RGB texel as 0x00BBGGRR
+	const GLubyte* texel = pixels + ((size_t) y * source_width + x) * 3;
+	return texel[0] | (texel[1] << 8) | (texel[2] << 16);
+}
+
+static void bilinear_scalar(SoftwareJob* job, float s, float t, GLubyte* out){	//One pixel, same math as the SIMD path
+	const GLubyte* pixels = job->source->texture_pixels;
+	int source_width = job->source->width, source_height = job->source->height;
+	int x0, y0, x1, y1, wx, wy, c;
+	if(s < -0.5f || t < -0.5f || s > source_width - 0.5f || t > source_height - 0.5f){	//Outside the quad
+		out[0] = 0;
+		out[1] = 104;
+		out[2] = 55;
+		return;
+	}
+	s = s < 0 ? 0 : (s > source_width - 1 ? source_width - 1 : s);	//Clamp to edge, like the GL texture
+	t = t < 0 ? 0 : (t > source_height - 1 ? source_height - 1 : t);
+	x0 = (int) s;
+	y0 = (int) t;
+	wx = (int) ((s - x0) * 128 + 0.5f);	//7 bit weights keep the SIMD products inside 16 bits
+	wy = (int) ((t - y0) * 128 + 0.5f);
+	x1 = x0 + 1 < source_width ? x0 + 1 : x0;
+	y1 = y0 + 1 < source_height ? y0 + 1 : y0;
+	for(c = 0; c < 3; c++){
+		int a = pixels[((size_t) y0 * source_width + x0) * 3 + c];
+		int b = pixels[((size_t) y0 * source_width + x1) * 3 + c];
+		int d = pixels[((size_t) y1 * source_width + x0) * 3 + c];
+		int e = pixels[((size_t) y1 * source_width + x1) * 3 + c];
+		int top = a + (((b - a) * wx + 64) >> 7);
+		int bottom = d + (((e - d) * wx + 64) >> 7);
+		out[c] = top + (((bottom - top) * wy + 64) >> 7);
+	}
+}
+
+#ifdef USE_SSE2
+static __m128i lerp_16(__m128i a, __m128i b, __m128i weight){	//a + (b - a) * weight / 128 in 16 bit lanes
+	__m128i difference = _mm_mullo_epi16(_mm_sub_epi16(b, a), weight);
+	return _mm_add_epi16(a, _mm_srai_epi16(_mm_add_epi16(difference, _mm_set1_epi16(64)), 7));
+}
+
+static void bilinear_sse2(SoftwareJob* job, float s, float t, GLubyte* out){	//Four neighbouring pixels of a row
+	const GLubyte* pixels = job->source->texture_pixels;
+	int source_width = job->source->width, source_height = job->source->height;
+	__m128 steps = _mm_set_ps(3, 2, 1, 0);
+	__m128 vs = _mm_add_ps(_mm_set1_ps(s), _mm_mul_ps(steps, _mm_set1_ps(job->ds_dx)));
+	__m128 vt = _mm_add_ps(_mm_set1_ps(t), _mm_mul_ps(steps, _mm_set1_ps(job->dt_dx)));
+	__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(vs, _mm_set1_ps(-0.5f)), _mm_cmpge_ps(vt, _mm_set1_ps(-0.5f))),
+								_mm_and_ps(_mm_cmple_ps(vs, _mm_set1_ps(source_width - 0.5f)),
+											_mm_cmple_ps(vt, _mm_set1_ps(source_height - 0.5f))));
+	__m128i x0, y0, wx, wy, top, bottom, low, high, result;
+	int xs[4], ys[4], wxs[4], wys[4], mask[4], i;
+	unsigned int a[4], b[4], d[4], e[4], colors[4];
+	
+	vs = _mm_min_ps(_mm_max_ps(vs, _mm_setzero_ps()), _mm_set1_ps(source_width - 1));	//Clamp to edge
+	vt = _mm_min_ps(_mm_max_ps(vt, _mm_setzero_ps()), _mm_set1_ps(source_height - 1));
+	x0 = _mm_cvttps_epi32(vs);	//Truncation is floor once clamped
+	y0 = _mm_cvttps_epi32(vt);
+	wx = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(vs, _mm_cvtepi32_ps(x0)), _mm_set1_ps(128)), _mm_set1_ps(0.5f)));
+	wy = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(vt, _mm_cvtepi32_ps(y0)), _mm_set1_ps(128)), _mm_set1_ps(0.5f)));
+	_mm_storeu_si128((__m128i*) xs, x0);
+	_mm_storeu_si128((__m128i*) ys, y0);
+	_mm_storeu_si128((__m128i*) wxs, wx);
+	_mm_storeu_si128((__m128i*) wys, wy);
+	_mm_storeu_si128((__m128i*) mask, _mm_castps_si128(inside));
+	
+	for(i = 0; i < 4; i++){	//Gather the 2x2 neighbourhood of each pixel
+		int x1 = xs[i] + 1 < source_width ? xs[i] + 1 : xs[i];
+		int y1 = ys[i] + 1 < source_height ? ys[i] + 1 : ys[i];
+		a[i] = fetch_texel(pixels, source_width, xs[i], ys[i]);
+		b[i] = fetch_texel(pixels, source_width, x1, ys[i]);
+		d[i] = fetch_texel(pixels, source_width, xs[i], y1);
+		e[i] = fetch_texel(pixels, source_width, x1, y1);
+	}
+	
+	//Pixels 0 and 1 in the low register, 2 and 3 in the high one, four 16 bit channels each
+	wx = _mm_set_epi16(wxs[1], wxs[1], wxs[1], wxs[1], wxs[0], wxs[0], wxs[0], wxs[0]);
+	wy = _mm_set_epi16(wys[1], wys[1], wys[1], wys[1], wys[0], wys[0], wys[0], wys[0]);
+	top = lerp_16(_mm_unpacklo_epi8(_mm_loadu_si128((__m128i*) a), _mm_setzero_si128()),
+					_mm_unpacklo_epi8(_mm_loadu_si128((__m128i*) b), _mm_setzero_si128()), wx);
+	bottom = lerp_16(_mm_unpacklo_epi8(_mm_loadu_si128((__m128i*) d), _mm_setzero_si128()),
+					_mm_unpacklo_epi8(_mm_loadu_si128((__m128i*) e), _mm_setzero_si128()), wx);
+	low = lerp_16(top, bottom, wy);
+	wx = _mm_set_epi16(wxs[3], wxs[3], wxs[3], wxs[3], wxs[2], wxs[2], wxs[2], wxs[2]);
+	wy = _mm_set_epi16(wys[3], wys[3], wys[3], wys[3], wys[2], wys[2], wys[2], wys[2]);
+	top = lerp_16(_mm_unpackhi_epi8(_mm_loadu_si128((__m128i*) a), _mm_setzero_si128()),
+					_mm_unpackhi_epi8(_mm_loadu_si128((__m128i*) b), _mm_setzero_si128()), wx);
+	bottom = lerp_16(_mm_unpackhi_epi8(_mm_loadu_si128((__m128i*) d), _mm_setzero_si128()),
+					_mm_unpackhi_epi8(_mm_loadu_si128((__m128i*) e), _mm_setzero_si128()), wx);
+	high = lerp_16(top, bottom, wy);
+	result = _mm_packus_epi16(low, high);
+	result = _mm_or_si128(_mm_and_si128(_mm_castps_si128(inside), result),	//Background outside the quad
+							_mm_andnot_si128(_mm_castps_si128(inside), _mm_set1_epi32(0 | (104 << 8) | (55 << 16))));
+	_mm_storeu_si128((__m128i*) colors, result);
+	for(i = 0; i < 4; i++){
+		out[i * 3] = colors[i] & 0xff;
+		out[i * 3 + 1] = (colors[i] >> 8) & 0xff;
+		out[i * 3 + 2] = (colors[i] >> 16) & 0xff;
+	}
+}
+#endif
+
+static void kernel_pixel(SoftwareJob* job, float s, float t, GLubyte* out){	//One pixel for the other filters
+	int source_width = job->source->width, source_height = job->source->height;
+	if(s < -0.5f || t < -0.5f || s > source_width - 0.5f || t > source_height - 0.5f){	//Outside the quad
+		out[0] = 0;
+		out[1] = 104;
+		out[2] = 55;
+	}else if(job->filter == FILTER_NEAREST){
+		int x = (int) (s + 0.5f), y = (int) (t + 0.5f);
+		const GLubyte* texel;
+		x = x < source_width ? x : source_width - 1;
+		y = y < source_height ? y : source_height - 1;
+		texel = job->source->texture_pixels + ((size_t) y * source_width + x) * 3;
+		out[0] = texel[0];
+		out[1] = texel[1];
+		out[2] = texel[2];
+	}else{
+		filter_pixel(job->source, job->filter, s, t, job->widen_s, job->widen_t, out);
+	}
+}
+
+void software_tile(void* arg, int tile){	//Render one SOFTWARE_TILE square of the target
+	SoftwareJob* job = arg;
+	int target_width = job->target->width, target_height = job->target->height;
+	int x_start = (tile % job->tiles_across) * SOFTWARE_TILE;
+	int y_start = (tile / job->tiles_across) * SOFTWARE_TILE;
+	int x_end = x_start + SOFTWARE_TILE < target_width ? x_start + SOFTWARE_TILE : target_width;
+	int y_end = y_start + SOFTWARE_TILE < target_height ? y_start + SOFTWARE_TILE : target_height;
+	int x, y;
+	float corners[8] = {x_start, y_start, x_end - 1, y_start, x_start, y_end - 1, x_end - 1, y_end - 1};
+	float min_s, max_s, min_t, max_t;
+	
+	affine_apply_many(&job->to_texel, corners, corners, 4);	//Texel positions of the tile's corner pixels
+	min_s = fminf(fminf(corners[0], corners[2]), fminf(corners[4], corners[6]));
+	max_s = fmaxf(fmaxf(corners[0], corners[2]), fmaxf(corners[4], corners[6]));
+	min_t = fminf(fminf(corners[1], corners[3]), fminf(corners[5], corners[7]));
+	max_t = fmaxf(fmaxf(corners[1], corners[3]), fmaxf(corners[5], corners[7]));
+	if(max_s < -0.51f || max_t < -0.51f || min_s > job->source->width - 0.49f || min_t > job->source->height - 0.49f){
+		//A hundredth of a texel to spare, so rounding never culls a pixel the loop below would draw
+		for(y = y_start; y < y_end; y++){	//The whole tile misses the quad, same colour the pixels would get
+			GLubyte* out = job->target->texture_pixels + ((size_t) y * target_width + x_start) * 3;
+			for(x = x_start; x < x_end; x++, out += 3){
+				out[0] = 0;
+				out[1] = 104;
+				out[2] = 55;
+			}
+		}
+		return;
+	}
+	for(y = y_start; y < y_end; y++){
+		float s = job->s0 + x_start * job->ds_dx + y * job->ds_dy;
+		float t = job->t0 + x_start * job->dt_dx + y * job->dt_dy;
+		GLubyte* out = job->target->texture_pixels + ((size_t) y * target_width + x_start) * 3;
+		x = x_start;
+		if(job->filter != FILTER_BILINEAR){
+			for(; x < x_end; x++, out += 3){
+				kernel_pixel(job, s, t, out);
+				s += job->ds_dx;
+				t += job->dt_dx;
+			}
+			continue;
+		}
+#ifdef USE_SSE2
+		for(; x + 4 <= x_end; x += 4, out += 12){
+			bilinear_sse2(job, s, t, out);
+			s += 4 * job->ds_dx;
+			t += 4 * job->dt_dx;
+		}
+#endif
+		for(; x < x_end; x++, out += 3){
+			bilinear_scalar(job, s, t, out);
+			s += job->ds_dx;
+			t += job->dt_dx;
+		}
+	}
+}
+
+void render_software(Triple* source, Triple* target, const Affine* transform, int parallel, int widen){	//Draw source
+										//through transform like the GL path, on all threads if parallel, and with kernels
+										//widened to the pixel footprint if widen (the GL shaders never widen)
+	SoftwareJob job;
+	int target_width = target->width, target_height = target->height;
+	int tiles_down = (target_height + SOFTWARE_TILE - 1) / SOFTWARE_TILE;
+	Affine pixel_to_screen = {{2.f / target_width, 0, 0, -2.f / target_height},	//Target pixel centres to clip space
+								{1.f / target_width - 1, 1 - 1.f / target_height}};
+	Affine quad_to_texel = {{source->width / 2.f, 0, 0, -source->height / 2.f},	//See Vertices, texel centres on
+							{source->width / 2.f - 0.5f, source->height / 2.f - 0.5f}};	//integers
+	
+	affine_invert(&job.to_texel, transform);	//Composed rather than differenced from mapped points, so the steps
+	affine_compose(&job.to_texel, &job.to_texel, &pixel_to_screen);	//do not lose precision far from the origin
+	affine_compose(&job.to_texel, &quad_to_texel, &job.to_texel);
+	job.s0 = job.to_texel.offset[0];
+	job.t0 = job.to_texel.offset[1];
+	job.ds_dx = job.to_texel.linear[0];
+	job.dt_dx = job.to_texel.linear[1];
+	job.ds_dy = job.to_texel.linear[2];
+	job.dt_dy = job.to_texel.linear[3];
+	
+	job.source = source;
+	job.target = target;
+	job.filter = resample_filter;
+	job.widen_s = widen ? hypotf(job.ds_dx, job.ds_dy) : 1;	//Source texels one target pixel spans along each axis
+	job.widen_t = widen ? hypotf(job.dt_dx, job.dt_dy) : 1;
+	job.widen_s = job.widen_s > 1 ? job.widen_s : 1;	//Only shrinking widens the kernel
+	job.widen_t = job.widen_t > 1 ? job.widen_t : 1;
+	job.tiles_across = (target_width + SOFTWARE_TILE - 1) / SOFTWARE_TILE;
+	if(parallel){
+		parallel_for(job.tiles_across * tiles_down, software_tile, &job);
+	}else{
+		int tile;
+		for(tile = 0; tile < job.tiles_across * tiles_down; tile++)
+			software_tile(&job, tile);
+	}
+}
+
+int run_software(Triple* texture_struct, char* output_name){	//Render on the CPU without any GL and save a PPM
+	Triple frame;
+	double total = 0, slowest = 0, fastest = 0;
+	int i;
+	
+	frame.width = width;
+	frame.height = height;
+	frame.texture_pixels = malloc((size_t) width * height * 3);
+	if(frame.texture_pixels == NULL){
+		fprintf(stderr, "Error: Out of memory for the software framebuffer\n");
+		exit(1);
+	}
+	update_mvp();
+	for(i = 0; i < headless_frames; i++){
+		double start = now_seconds(), elapsed;
+		render_software(texture_struct, &frame, &view_transform, 1, 0);
+		elapsed = now_seconds() - start;
+		total += elapsed;
+		if(i == 0 || elapsed > slowest) slowest = elapsed;
+		if(i == 0 || elapsed < fastest) fastest = elapsed;
+	}
+	write_ppm_file(output_name, &frame);
+	free(frame.texture_pixels);
+	printf("%dx%d, %d frames on %d threads: mean %.3f ms, min %.3f ms, max %.3f ms\n", width, height, headless_frames,
+			pool.threads, total * 1000 / headless_frames, fastest * 1000, slowest * 1000);
+	return EXIT_SUCCESS;
+}
+//-------------------------------------
+
+//Batch transforms -----------------------------
+
+void add_transform_option(int kind, char* value){	//Queue a transform given on the command line
+	KeyMotion* option;
+	if(transform_option_count == MAX_TRANSFORM_OPTIONS){
+		fprintf(stderr, "Error: Too many transform options\n");
+		exit(1);
+	}
+	option = &transform_options[transform_option_count++];
+	option->key = 0;
+	option->kind = kind;
+	option->y = 0;
+	if(kind == MOTION_SHEAR || kind == MOTION_TRANSLATE){	//Pairs are written x,y
+		if(sscanf(value, "%f,%f", &option->x, &option->y) != 2){
+			fprintf(stderr, "Error: Expected x,y but got %s\n", value);
+			exit(1);
+		}
+	}else if(sscanf(value, "%f", &option->x) != 1){
+		fprintf(stderr, "Error: Expected a number but got %s\n", value);
+		exit(1);
+	}
+}
+
+void apply_transform_options(){	//Add the queued options to the view, with the same functions as the keys
+	int i;
+	for(i = 0; i < transform_option_count; i++){
+		KeyMotion* option = &transform_options[i];
+		if(option->kind == MOTION_ROTATE)
+			rotate_matrix(option->x * (float) M_PI / 180);	//Degrees on the command line
+		else if(option->kind == MOTION_SCALE)
+			scale_matrix(option->x);
+		else if(option->kind == MOTION_TRANSLATE)
+			translate_matrix(option->x, option->y);
+		else
+			shear_matrix(option->x, option->y);
+	}
+}
+
+int run_batch(Triple* texture_struct, char* output_name){	//Transform an image on the CPU and write it at its own size
+	Triple result;
+	double start;
+	
+	result.width = width = texture_struct->width;	//Aspect ratio of the transforms follows the image
+	result.height = height = texture_struct->height;
+	result.texture_pixels = malloc((size_t) width * height * 3);
+	if(result.texture_pixels == NULL){
+		fprintf(stderr, "Error: Out of memory for the output image\n");
+		exit(1);
+	}
+	apply_transform_options();
+	update_mvp();
+	start = now_seconds();
+	render_software(texture_struct, &result, &view_transform, 1, 1);
+	printf("%dx%d transformed in %.3f ms on %d threads\n", width, height, (now_seconds() - start) * 1000, pool.threads);
+	write_ppm_file(output_name, &result);
+	free(result.texture_pixels);
+	return EXIT_SUCCESS;
+}
+void build_transform(Affine* transform, int image_width, int image_height){	//Queued options for one image size
+	int saved_width, saved_height;
+	ViewState saved_view;
+	saved_width = width;	//The transform functions work on the globals, so only the main thread may call this
+	saved_height = height;
+	saved_view = view;
+	width = image_width;
+	height = image_height;
+	reset_view();
+	apply_transform_options();
+	update_mvp();
+	*transform = view_transform;
+	width = saved_width;
+	height = saved_height;
+	view = saved_view;
+	view_dirty = 1;
+}
+
+int is_directory(char* path){
+	struct stat info;
+	return stat(path, &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
+char* join_path(char* directory, char* name){	//directory/name in newly allocated memory
+	size_t length = strlen(directory);
+	char* path = malloc(length + strlen(name) + 2);
+	strcpy(path, directory);
+	if(length > 0 && directory[length - 1] != '/' && directory[length - 1] != '\\')
+		strcat(path, "/");
+	strcat(path, name);
+	return path;
+}
+
+int has_ppm_extension(const char* name){
+	size_t length = strlen(name);
+	return length > 4 && name[length - 4] == '.' && tolower((unsigned char) name[length - 3]) == 'p' &&
+			tolower((unsigned char) name[length - 2]) == 'p' && tolower((unsigned char) name[length - 1]) == 'm';
+}
+
+int compare_names(const void* a, const void* b){
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+char** list_ppm_files(char* directory, int* count){	//Sorted names of the .ppm files in a directory
+	char** names = NULL;
+	int capacity = 0;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	char* pattern = join_path(directory, "*");
+	HANDLE search = FindFirstFileA(pattern, &found);
+	free(pattern);
+	*count = 0;
+	if(search == INVALID_HANDLE_VALUE) return NULL;
+	do{
+		char* name = found.cFileName;
+#else
+	DIR* dir = opendir(directory);
+	struct dirent* entry;
+	*count = 0;
+	if(dir == NULL) return NULL;
+	while((entry = readdir(dir)) != NULL){
+		char* name = entry->d_name;
+#endif
+		if(!has_ppm_extension(name)) continue;
+		if(*count == capacity){
+			capacity = capacity * 2 + 64;
+			names = realloc(names, sizeof(char*) * capacity);
+		}
+		names[*count] = malloc(strlen(name) + 1);
+		strcpy(names[(*count)++], name);
+#ifdef _WIN32
+	}while(FindNextFileA(search, &found));
+	FindClose(search);
+#else
+	}
+	closedir(dir);
+#endif
+	if(*count > 0) qsort(names, *count, sizeof(char*), compare_names);
+	return names;
+}
+
+long long file_size(char* path){	//In bytes, 0 if it cannot be found
+#ifdef _WIN32
+	struct _stati64 info;	//Plain stat() sizes are 32 bits here
+	return _stati64(path, &info) == 0 ? (long long) info.st_size : 0;
+#else
+	struct stat info;
+	return stat(path, &info) == 0 ? (long long) info.st_size : 0;
+#endif
+}
+
+void release_batch_memory(size_t bytes){	//Give back an in-flight reservation and let the feeder continue
+	mutex_lock(&batch.lock);
+	batch.in_flight -= bytes;
+	condition_broadcast(&batch.room);
+	mutex_unlock(&batch.lock);
+}
+
+void finish_batch_item(BatchItem* item){	//Let the next file in and forget this one
+	release_batch_memory(item->reserved);
+	free(item->input);
+	free(item->output);
+	free(item);
+}
+
+void encode_task(void* arg, int worker){	//Last stage, write the result
+	BatchItem* item = arg;
+	if(try_write_ppm_file(item->output, &item->result))
+		atomic_add64(&batch.bytes_written, (long long) item->result.width * item->result.height * 3);
+	else
+		atomic_increment(&batch.failed);
+	free(item->result.texture_pixels);
+	finish_batch_item(item);
+}
+
+void transform_task(void* arg, int worker){	//Middle stage, resample on this worker alone
+	BatchItem* item = arg;
+	if(item->source->width != item->width || item->source->height != item->height){	//Rewritten since the feeder
+		fprintf(stderr, "Error: %s changed size during the batch\n", item->input);		//read its header
+		free_triple(item->source);
+		atomic_increment(&batch.failed);
+		finish_batch_item(item);
+		return;
+	}
+	item->result.width = item->source->width;
+	item->result.height = item->source->height;
+	item->result.texture_pixels = malloc((size_t) item->result.width * item->result.height * 3);
+	if(item->result.texture_pixels == NULL){	//Skip it, files after it may well fit
+		fprintf(stderr, "Error: Out of memory transforming %s\n", item->input);
+		free_triple(item->source);
+		atomic_increment(&batch.failed);
+		finish_batch_item(item);
+		return;
+	}
+	render_software(item->source, &item->result, &item->transform, 0, 1);	//Files are the parallel unit here
+	free_triple(item->source);
+	submit_task(worker, encode_task, item);
+}
+
+void decode_task(void* arg, int worker){	//First stage, read the file
+	BatchItem* item = arg;
+	item->source = try_read_ppm_file(item->input);
+	if(item->source == NULL){	//Already reported, the rest of the directory goes on
+		atomic_increment(&batch.failed);
+		finish_batch_item(item);
+		return;
+	}
+	submit_task(worker, transform_task, item);	//Newest first on this worker keeps the pixels in its cache
+}
+
+int run_batch_directory(char* input_directory, char* output_directory){	//Transform every PPM in a directory concurrently
+	char** names;
+	int count, i, size_count = 0;
+	int* sizes = NULL;			//Width and height pairs seen so far
+	Affine* transforms = NULL;	//The transform for each of them
+	double start, elapsed;
+	long long bytes_read = 0;
+	
+	names = list_ppm_files(input_directory, &count);
+	if(count == 0){
+		fprintf(stderr, "Error: No .ppm files in %s\n", input_directory);
+		exit(1);
+	}
+	if(!is_directory(output_directory)){
+#ifdef _WIN32
+		CreateDirectoryA(output_directory, NULL);
+#else
+		mkdir(output_directory, 0777);
+#endif
+		if(!is_directory(output_directory)){
+			fprintf(stderr, "Error: Could not create directory %s\n", output_directory);
+			exit(1);
+		}
+	}
+	mutex_init(&batch.lock);
+	condition_init(&batch.room);
+	start_stealing_pool();
+	
+	start = now_seconds();
+	for(i = 0; i < count; i++){	//Admit files while their estimated memory fits the in-flight budget
+		BatchItem* item = calloc(1, sizeof(BatchItem));
+		long long size;
+		int known;
+		item->input = join_path(input_directory, names[i]);
+		item->output = join_path(output_directory, names[i]);
+		free(names[i]);
+		if(!try_read_ppm_size(item->input, &item->width, &item->height)){
+			atomic_increment(&batch.failed);
+			free(item->input);
+			free(item->output);
+			free(item);
+			continue;
+		}
+		for(known = 0; known < size_count; known++)	//Images in a directory usually share a few sizes
+			if(sizes[known * 2] == item->width && sizes[known * 2 + 1] == item->height) break;
+		if(known == size_count){
+			sizes = realloc(sizes, sizeof(int) * 2 * (size_count + 1));
+			transforms = realloc(transforms, sizeof(Affine) * (size_count + 1));
+			sizes[known * 2] = item->width;
+			sizes[known * 2 + 1] = item->height;
+			build_transform(&transforms[known], item->width, item->height);
+			size_count++;
+		}
+		item->transform = transforms[known];
+		size = file_size(item->input);
+		item->reserved = (size_t) size * 2;	//Source and result, P3 text only overestimates
+		bytes_read += size;
+		mutex_lock(&batch.lock);
+		while(batch.in_flight > 0 && batch.in_flight + item->reserved > batch_memory)
+			condition_wait(&batch.room, &batch.lock);	//An oversized file still runs, alone
+		batch.in_flight += item->reserved;
+		mutex_unlock(&batch.lock);
+		submit_task(-1, decode_task, item);
+	}
+	wait_for_tasks();
+	elapsed = now_seconds() - start;
+	free(names);
+	free(sizes);
+	free(transforms);
+	
+	printf("%d images in %.3f s on %d threads: %.1f images/s, %.1f MB/s read, %.1f MB/s written, %ld failed\n", count,
+			elapsed, stealer.workers, (count - batch.failed) / elapsed, bytes_read / elapsed / (1024 * 1024),
+			batch.bytes_written / elapsed / (1024 * 1024), batch.failed);
+	return batch.failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+//-------------------------------------
+
+//File watching -----------------------------
+
+int file_state(char* path, struct stat* info){	//Stat a file, 0 if it is missing
+	return path != NULL && stat(path, info) == 0;
+}
+
+int same_state(struct stat* a, struct stat* b){	//Same file, size and modification time
+#ifdef __linux__
+	if(a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) return 0;	//Rewrites within one second
+#endif
+	return a->st_mtime == b->st_mtime && a->st_size == b->st_size && a->st_ino == b->st_ino;
+}
+
+void* watch_thread(void* arg){	//Wait for the watched file to change, then decode it for the render loop
+	char* path = NULL;
+	int version = -1;
+	struct stat known, now, settled;
+#ifdef __linux__
+	int notify = inotify_init1(IN_NONBLOCK);	//Watch the directory, writers often replace the file by renaming
+	int directory_watch = -1;
+	char events[4096];
+#endif
+	memset(&known, 0, sizeof(known));
+	while(1){
+		int changed = 0;
+		mutex_lock(&watch.lock);
+		if(watch.path_version != version){	//Render loop moved on to another file
+			version = watch.path_version;
+			free(path);
+			path = malloc(strlen(watch.path) + 1);
+			strcpy(path, watch.path);
+			if(!file_state(path, &known))
+				memset(&known, 0, sizeof(known));
+#ifdef __linux__
+			if(notify >= 0){
+				char* slash = strrchr(path, '/');
+				if(directory_watch >= 0)
+					inotify_rm_watch(notify, directory_watch);
+				if(slash != NULL) *slash = 0;
+				directory_watch = inotify_add_watch(notify, slash != NULL ? (path[0] ? path : "/") : ".",
+													IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+				if(slash != NULL) *slash = '/';
+			}
+#endif
+		}
+		mutex_unlock(&watch.lock);
+		
+#ifdef __linux__
+		if(notify >= 0 && directory_watch >= 0){	//Sleep until something in the directory changes
+			struct pollfd wait_for = {notify, POLLIN, 0};
+			if(poll(&wait_for, 1, WATCH_INTERVAL) > 0)
+				while(read(notify, events, sizeof(events)) > 0);	//Names are not checked, stat below decides
+		}else{
+			sleep_ms(WATCH_INTERVAL);
+		}
+#else
+		sleep_ms(WATCH_INTERVAL);	//Poll the modification time
+#endif
+		if(file_state(path, &now) && !same_state(&now, &known)){	//Wait for the writer to finish
+			do{
+				settled = now;
+				sleep_ms(WATCH_SETTLE);
+			}while(file_state(path, &now) && !same_state(&now, &settled));
+			changed = file_state(path, &now) && now.st_size > 0;
+		}
+		if(changed){
+			Triple* fresh = try_read_ppm_file(path);
+			known = now;	//A file that fails to decode is tried again when it next changes
+			if(fresh == NULL) continue;	//Half written or broken, the old raster stays on screen
+			mutex_lock(&watch.lock);
+			if(watch.path_version == version){	//Still the file on screen
+				if(watch.reloaded != NULL) free_triple(watch.reloaded);
+				watch.reloaded = fresh;
+				watch.reloaded_version = version;
+				fresh = NULL;
+			}
+			mutex_unlock(&watch.lock);
+			if(fresh != NULL) free_triple(fresh);
+			else glfwPostEmptyEvent();	//Wake the render loop for apply_reload()
+		}
+	}
+	return NULL;
+}
+
+void watch_file(char* path){	//Watch this file from now on, starting the watcher the first time
+	static int started = 0;
+	if(!started){
+		mutex_init(&watch.lock);
+		started = 1;
+		thread_start(watch_thread, NULL);
+	}
+	mutex_lock(&watch.lock);
+	watch.path = path;
+	watch.path_version++;
+	if(watch.reloaded != NULL){	//Meant for the previous file
+		free_triple(watch.reloaded);
+		watch.reloaded = NULL;
+	}
+	mutex_unlock(&watch.lock);
+}
+
+int rows_differ(const GLubyte* a, const GLubyte* b, size_t bytes){	//Compare two runs of pixels
+	size_t i = 0;
+#ifdef USE_SSE2
+	for(; i + 64 <= bytes; i += 64){	//Four vectors per test keeps the loop on the loads
+		__m128i same = _mm_and_si128(
+			_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i)), _mm_loadu_si128((const __m128i*) (b + i))),
+						_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i + 16)), _mm_loadu_si128((const __m128i*) (b + i + 16)))),
+			_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i + 32)), _mm_loadu_si128((const __m128i*) (b + i + 32))),
+						_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i + 48)), _mm_loadu_si128((const __m128i*) (b + i + 48)))));
+		if(_mm_movemask_epi8(same) != 0xffff) return 1;
+	}
+#endif
+	return memcmp(a + i, b + i, bytes - i) != 0;
+}
+
+GLuint apply_reload(GLuint myTexture){	//Take a finished reload into the shown image, returns the texture to draw
+	Triple* fresh;
+	Triple* shown = residency.full;
+	int image_width, image_height, band, bands, first_dirty = -1, dirty = 0;
+	size_t row_bytes;
+	
+	mutex_lock(&watch.lock);
+	fresh = watch.reloaded;
+	watch.reloaded = NULL;
+	mutex_unlock(&watch.lock);
+	if(fresh == NULL || shown == NULL) return myTexture;
+	image_width = shown->width;
+	image_height = shown->height;
+	row_bytes = (size_t) image_width * 3;
+	needs_redraw = 1;
+	
+	if(fresh->width != shown->width || fresh->height != shown->height || residency.level > 0){
+		//New size, or a downscaled level that has to be rebuilt anyway, so upload everything. The Triple itself
+		//stays, the browse cache points at it
+		free(shown->texture_pixels);
+		*shown = *fresh;
+		free(fresh);
+		forget_texture(residency.texture);
+		glDeleteTextures(1, &residency.texture);
+		printf("Reloaded %dx%d image\n", (int) shown->width, (int) shown->height);
+		return new_texture(shown);
+	}
+	
+	bands = (image_height + RELOAD_BAND - 1) / RELOAD_BAND;
+	cached_bind_texture(residency.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for(band = 0; band <= bands; band++){	//Upload each run of changed bands in one call
+		int changed = 0;
+		if(band < bands){
+			int rows = band == bands - 1 ? image_height - band * RELOAD_BAND : RELOAD_BAND;
+			size_t offset = (size_t) band * RELOAD_BAND * row_bytes;
+			changed = rows_differ(shown->texture_pixels + offset, fresh->texture_pixels + offset, rows * row_bytes);
+			if(changed){
+				memcpy(shown->texture_pixels + offset, fresh->texture_pixels + offset, rows * row_bytes);
+				dirty++;
+			}
+		}
+		if(changed && first_dirty < 0){
+			first_dirty = band;
+		}else if(!changed && first_dirty >= 0){
+			int y = first_dirty * RELOAD_BAND;
+			int rows = (band * RELOAD_BAND < image_height ? band * RELOAD_BAND : image_height) - y;
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, image_width, rows, GL_RGB, GL_UNSIGNED_BYTE,
+							shown->texture_pixels + (size_t) y * row_bytes);
+			first_dirty = -1;
+		}
+	}
+	free_triple(fresh);
+	printf("Reloaded, %d of %d row bands changed\n", dirty, bands);
+	return myTexture;
+}
+//-------------------------------------
+
+//Browsing -----------------------------
+
+void add_browse_name(char* path){	//Append to the browse list
+	if(browser.count % 64 == 0)
+		browser.names = realloc(browser.names, sizeof(char*) * (browser.count + 64));
+	browser.names[browser.count++] = path;
+}
+
+void browse_directory(char* directory){	//Replace the browse list with the .ppm files of a directory
+	char** names;
+	int count, i;
+	names = list_ppm_files(directory, &count);
+	if(count == 0){
+		fprintf(stderr, "Error: No .ppm files in %s\n", directory);
+		exit(1);
+	}
+	browser.count = 0;
+	if(thumb_db.path == NULL)	//Thumbnails of a directory are kept next to it
+		thumb_db.path = join_path(directory, ".ezview-thumbs");
+	for(i = 0; i < count; i++){
+		add_browse_name(join_path(directory, names[i]));
+		free(names[i]);
+	}
+	free(names);
+}
+
+int browse_distance(int a, int b){	//Steps between two list entries, the list wraps around
+	int distance = abs(a - b);
+	return distance < browser.count - distance ? distance : browser.count - distance;
+}
+
+CachedImage* find_cached(int index){	//Slot holding a list entry, call with browser.lock held
+	int i;
+	for(i = 0; i < BROWSE_CACHE; i++)
+		if(browser.slots[i].index == index)
+			return &browser.slots[i];
+	return NULL;
+}
+
+void release_residency(Residency* resident){	//Delete the textures and buffer uploaded for an image
+	if(resident->texture != 0){
+		forget_texture(resident->texture);
+		glDeleteTextures(1, &resident->texture);
+	}
+	if(resident->detail_texture != 0){
+		forget_texture(resident->detail_texture);
+		forget_buffer(resident->detail_buffer);
+		glDeleteTextures(1, &resident->detail_texture);
+		glDeleteBuffers(1, &resident->detail_buffer);
+	}
+	memset(resident, 0, sizeof(Residency));
+}
+
+CachedImage* claim_slot(int index){	//Free or least recently used slot for a list entry, NULL if every slot is busy,
+	CachedImage* oldest = NULL;		//call from the GL thread with browser.lock held
+	int i;
+	for(i = 0; i < BROWSE_CACHE; i++){
+		CachedImage* slot = &browser.slots[i];
+		if(slot->loading || slot->index == browser.current) continue;
+		if(slot->index == -1){
+			oldest = slot;
+			break;
+		}
+		if(oldest == NULL || slot->last_used < oldest->last_used)
+			oldest = slot;
+	}
+	if(oldest == NULL) return NULL;
+	if(oldest->index != -1){	//Evict
+		release_residency(&oldest->residency);
+		free_triple(oldest->image);
+	}
+	oldest->index = index;
+	oldest->image = NULL;
+	oldest->loading = 1;
+	oldest->failed = 0;
+	oldest->last_used = ++browser.clock;
+	return oldest;
+}
+
+void fill_slot(CachedImage* slot, Triple* image){	//Finish a decode, a failed one shows a placeholder,
+	slot->failed = image == NULL;					//call with browser.lock held
+	slot->image = image != NULL ? image : placeholder_image();
+	slot->loading = 0;
+}
+
+void decode_neighbour(void* arg, int worker){	//Prefetch task, decode one list entry into its slot
+	CachedImage* slot = arg;
+	Triple* image = try_read_ppm_file(browser.names[slot->index]);	//index holds still while loading is set
+	mutex_lock(&browser.lock);
+	fill_slot(slot, image);
+	condition_broadcast(&browser.loaded);
+	mutex_unlock(&browser.lock);
+	glfwPostEmptyEvent();	//Wake the render loop so warm_textures() can upload it
+}
+
+void prefetch_neighbours(){	//Queue decodes around the current image, nearest ones used last so they are evicted last
+	int distance, side;
+	mutex_lock(&browser.lock);
+	for(distance = BROWSE_AHEAD; distance >= 1; distance--){
+		for(side = -1; side <= 1; side += 2){
+			int index = ((browser.current + side * distance) % browser.count + browser.count) % browser.count;
+			CachedImage* slot;
+			if(index == browser.current) continue;	//Short lists wrap onto themselves
+			if((slot = find_cached(index)) != NULL){
+				slot->last_used = ++browser.clock;
+			}else if((slot = claim_slot(index)) != NULL){
+				submit_task(-1, decode_neighbour, slot);
+			}
+		}
+	}
+	mutex_unlock(&browser.lock);
+}
+
+void warm_textures(){	//Upload decoded neighbours near the current image and drop textures of ones further away
+	int i;
+	mutex_lock(&browser.lock);
+	for(i = 0; i < BROWSE_CACHE; i++){
+		CachedImage* slot = &browser.slots[i];
+		if(slot->index == -1 || slot->index == browser.current || slot->image == NULL) continue;
+		if(browse_distance(slot->index, browser.current) > BROWSE_WARM){
+			if(slot->residency.texture != 0)
+				release_residency(&slot->residency);
+		}else if(slot->residency.texture == 0){	//new_texture() fills in the global residency
+			Residency shown = residency;
+			memset(&residency, 0, sizeof(Residency));	//So the shown image's detail texture is not shared
+			new_texture(slot->image);
+			slot->residency = residency;
+			residency = shown;
+		}
+	}
+	mutex_unlock(&browser.lock);
+}
+
+void start_browsing(Triple* first){	//Put the image already on screen in the cache and start prefetching around it
+	int i;
+	mutex_init(&browser.lock);
+	condition_init(&browser.loaded);
+	for(i = 0; i < BROWSE_CACHE; i++)
+		browser.slots[i].index = -1;
+	start_stealing_pool();
+	mutex_lock(&browser.lock);
+	browser.current = 0;
+	browser.slots[0].index = 0;
+	browser.slots[0].image = first;
+	browser.slots[0].last_used = ++browser.clock;
+	mutex_unlock(&browser.lock);
+	glfwSetWindowTitle(window, browser.names[0]);
+	prefetch_neighbours();
+}
+
+GLuint show_image(int index){	//Make a list entry current, decoding it here if no worker has, and return its texture
+	CachedImage* slot;
+	mutex_lock(&browser.lock);
+	slot = find_cached(browser.current);
+	if(slot != NULL)
+		slot->residency = residency;	//Keep any detail page_detail() uploaded for the old image
+	browser.current = index;
+	slot = find_cached(index);
+	if(slot == NULL){	//Not prefetched, the user outran the workers
+		Triple* image;
+		while((slot = claim_slot(index)) == NULL)	//Every other slot is still loading, take the first to finish
+			condition_wait(&browser.loaded, &browser.lock);
+		mutex_unlock(&browser.lock);
+		image = try_read_ppm_file(browser.names[index]);
+		mutex_lock(&browser.lock);
+		fill_slot(slot, image);
+	}
+	while(slot->loading)
+		condition_wait(&browser.loaded, &browser.lock);
+	slot->last_used = ++browser.clock;
+	if(slot->residency.texture == 0){
+		memset(&residency, 0, sizeof(Residency));	//The old image's textures now belong to its slot
+		new_texture(slot->image);
+		slot->residency = residency;
+	}else{
+		residency = slot->residency;
+	}
+	if(slot->failed){	//Say why the window shows a grey square
+		char* title = malloc(strlen(browser.names[index]) + 24);
+		sprintf(title, "%s (could not decode)", browser.names[index]);
+		glfwSetWindowTitle(window, title);
+		free(title);
+	}else
+		glfwSetWindowTitle(window, browser.names[index]);
+	mutex_unlock(&browser.lock);
+	needs_redraw = 1;
+	if(watch_enabled)
+		watch_file(browser.names[index]);
+	prefetch_neighbours();
+	return residency.texture;
+}
+//-------------------------------------
+
+//Thumbnail database -----------------------------
+
+int map_file(MappedFile* map, char* path, size_t size){	//Map a file read/write, creating it at size bytes if size
+	map->base = NULL;										//is not 0, otherwise mapping it as it is
+#ifdef _WIN32
+	LARGE_INTEGER file_bytes;
+	map->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+							size > 0 ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(map->file == INVALID_HANDLE_VALUE) return 0;
+	if(size == 0){
+		GetFileSizeEx(map->file, &file_bytes);
+		size = (size_t) file_bytes.QuadPart;
+	}
+	map->mapping = size > 0 ? CreateFileMappingA(map->file, NULL, PAGE_READWRITE, (DWORD) ((uint64_t) size >> 32),
+													(DWORD) size, NULL) : NULL;	//Creating the mapping sizes the file
+	if(map->mapping == NULL){
+		CloseHandle(map->file);
+		return 0;
+	}
+	map->base = MapViewOfFile(map->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if(map->base == NULL){
+		CloseHandle(map->mapping);
+		CloseHandle(map->file);
+		return 0;
+	}
+#else
+	struct stat info;
+	map->file = open(path, size > 0 ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+	if(map->file < 0) return 0;
+	if(size == 0 && fstat(map->file, &info) == 0)
+		size = info.st_size;
+	else if(size > 0 && ftruncate(map->file, size) != 0)
+		size = 0;
+	if(size == 0){
+		close(map->file);
+		return 0;
+	}
+	map->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, map->file, 0);
+	if(map->base == MAP_FAILED){
+		map->base = NULL;
+		close(map->file);
+		return 0;
+	}
+#endif
+	map->size = size;
+	return 1;
+}
+
+void unmap_file(MappedFile* map){
+	if(map->base == NULL) return;
+#ifdef _WIN32
+	UnmapViewOfFile(map->base);
+	CloseHandle(map->mapping);
+	CloseHandle(map->file);
+#else
+	munmap(map->base, map->size);
+	close(map->file);
+#endif
+	map->base = NULL;
+}
+
+uint64_t hash_path(const char* path){	//hash_bytes() of the path without its terminator, as stored records expect
+	return hash_bytes(HASH_START, path, strlen(path));
+}
+
+int thumb_db_key(const char* path, char* key){	//Absolute form of path, so records and their stat() do not depend
+#ifdef _WIN32											//on the working directory. 0 if it cannot be resolved or is too long
+	return _fullpath(key, path, THUMB_DB_PATH) != NULL;
+#else
+	char* absolute = realpath(path, NULL);
+	int fits = absolute != NULL && strlen(absolute) < THUMB_DB_PATH;
+	if(fits) strcpy(key, absolute);
+	free(absolute);
+	return fits;
+#endif
+}
+
+size_t thumb_db_size(uint32_t index_capacity, uint32_t record_capacity){
+	return sizeof(ThumbDbHeader) + sizeof(ThumbDbSlot) * index_capacity +
+			(sizeof(ThumbDbRecord) + THUMB_DB_BYTES) * (size_t) record_capacity;
+}
+
+void locate_thumb_db(){	//Point the table pointers into the mapping
+	unsigned char* base = thumb_db.map.base;
+	thumb_db.header = (ThumbDbHeader*) base;
+	thumb_db.index = (ThumbDbSlot*) (base + sizeof(ThumbDbHeader));
+	thumb_db.records = (ThumbDbRecord*) (thumb_db.index + thumb_db.header->index_capacity);
+	thumb_db.pixels = (GLubyte*) (thumb_db.records + thumb_db.header->record_capacity);
+}
+
+int valid_thumb_db(){	//Mapped file is a database this build can use
+	ThumbDbHeader* header = (ThumbDbHeader*) thumb_db.map.base;
+	return thumb_db.map.size >= sizeof(ThumbDbHeader) && memcmp(header->magic, "EZTHUMBS", 8) == 0 &&
+			header->version == THUMB_DB_VERSION && header->thumb_size == THUMB_SIZE &&
+			header->index_capacity > 0 && (header->index_capacity & (header->index_capacity - 1)) == 0 &&
+			header->index_capacity / 2 >= header->record_capacity &&	//Probing always finds an empty slot
+			thumb_db.map.size >= thumb_db_size(header->index_capacity, header->record_capacity) &&
+			header->record_count <= header->record_capacity;
+}
+
+int valid_record(ThumbDbRecord* record){	//Fields a damaged file could make unsafe to use
+	return record->width >= 1 && record->width <= THUMB_SIZE && record->height >= 1 && record->height <= THUMB_SIZE &&
+			memchr(record->path, 0, THUMB_DB_PATH) != NULL;
+}
+
+int find_record(uint64_t hash, const char* path){	//Record number for a path, -1 if absent, safe without a lock
+	uint32_t mask = thumb_db.header->index_capacity - 1, slot = (uint32_t) hash & mask;
+	while(1){
+		uint32_t record = thumb_db.index[slot].record;
+		if(record == 0) return -1;
+		if(record > thumb_db.header->record_count) return -1;	//Damaged index, the file is next to the images
+		memory_barrier();	//The hash was written before the record number
+		if(thumb_db.index[slot].hash == hash && strncmp(thumb_db.records[record - 1].path, path, THUMB_DB_PATH) == 0)
+			return record - 1;
+		slot = (slot + 1) & mask;
+	}
+}
+
+void insert_record(uint64_t hash, uint32_t record){	//Publish a finished record in the index, writers only
+	uint32_t mask = thumb_db.header->index_capacity - 1, slot = (uint32_t) hash & mask;
+	while(thumb_db.index[slot].record != 0)
+		slot = (slot + 1) & mask;
+	thumb_db.index[slot].hash = hash;
+	memory_barrier();
+	thumb_db.index[slot].record = record + 1;
+}
+
+int source_unchanged(ThumbDbRecord* record){	//Source file still has the size and time the thumbnail was made at,
+																//the path is absolute so this holds from any directory
+	struct stat info;
+	return stat(record->path, &info) == 0 && record->mtime == (int64_t) info.st_mtime &&
+			record->size == (int64_t) info.st_size;
+}
+
+void open_thumb_db(int wanted){	//Map the database with room for wanted new records, rebuilding it if it has none
+	MappedFile old;
+	ThumbDbHeader* header;
+	uint32_t record_capacity, index_capacity = 64, i, kept = 0;
+	char* temporary;
+	
+	mutex_init(&thumb_db.write_lock);
+	if(map_file(&thumb_db.map, thumb_db.path, 0)){
+		if(valid_thumb_db()){
+			locate_thumb_db();
+			if(thumb_db.header->record_capacity - thumb_db.header->record_count >= (uint32_t) wanted)
+				return;	//Room for every wanted image to be new
+		}else{
+			unmap_file(&thumb_db.map);	//Unknown or old layout, start over
+		}
+	}
+	//Rebuild into a bigger file, dropping records whose source is gone or changed
+	old = thumb_db.map;
+	record_capacity = ((old.base != NULL ? thumb_db.header->record_count : 0) + wanted) * 2 + 64;
+	while(index_capacity < record_capacity * 2)
+		index_capacity *= 2;
+	temporary = malloc(strlen(thumb_db.path) + 5);
+	sprintf(temporary, "%s.tmp", thumb_db.path);
+	if(!map_file(&thumb_db.map, temporary, thumb_db_size(index_capacity, record_capacity))){
+		fprintf(stderr, "Warning: Could not create thumbnail database %s\n", thumb_db.path);
+		unmap_file(&old);
+		thumb_db.map.base = NULL;
+		free(temporary);
+		return;
+	}
+	header = (ThumbDbHeader*) thumb_db.map.base;
+	memset(header, 0, sizeof(ThumbDbHeader));
+	memcpy(header->magic, "EZTHUMBS", 8);
+	header->version = THUMB_DB_VERSION;
+	header->thumb_size = THUMB_SIZE;
+	header->index_capacity = index_capacity;
+	header->record_capacity = record_capacity;
+	if(old.base != NULL){
+		ThumbDbHeader* old_header = thumb_db.header;
+		ThumbDbRecord* old_records = thumb_db.records;
+		GLubyte* old_pixels = thumb_db.pixels;
+		locate_thumb_db();
+		for(i = 0; i < old_header->record_count; i++){
+			if(!valid_record(&old_records[i]) || !source_unchanged(&old_records[i])) continue;
+			thumb_db.records[kept] = old_records[i];
+			memcpy(thumb_db.pixels + (size_t) kept * THUMB_DB_BYTES, old_pixels + (size_t) i * THUMB_DB_BYTES,
+					THUMB_DB_BYTES);
+			insert_record(old_records[i].hash, kept++);
+		}
+		header->record_count = kept;
+		unmap_file(&old);
+	}
+	unmap_file(&thumb_db.map);
+#ifdef _WIN32
+	MoveFileExA(temporary, thumb_db.path, MOVEFILE_REPLACE_EXISTING);
+#else
+	rename(temporary, thumb_db.path);
+#endif
+	free(temporary);
+	if(!map_file(&thumb_db.map, thumb_db.path, 0) || !valid_thumb_db()){
+		fprintf(stderr, "Warning: Could not open thumbnail database %s\n", thumb_db.path);
+		unmap_file(&thumb_db.map);
+		return;
+	}
+	locate_thumb_db();
+}
+
+Triple* lookup_thumbnail(char* path){	//Copy of a stored thumbnail if it is still current, NULL otherwise
+	struct stat info;
+	ThumbDbRecord* record;
+	char key[THUMB_DB_PATH];
+	int number, attempt;
+	if(thumb_db.map.base == NULL || !thumb_db_key(path, key) || stat(key, &info) != 0) return NULL;
+	if((number = find_record(hash_path(key), key)) < 0) return NULL;
+	record = &thumb_db.records[number];
+	for(attempt = 0; attempt < 4; attempt++){	//Seqlock read, retry if a writer got in between
+		uint32_t sequence = record->sequence;
+		Triple* thumb;
+		memory_barrier();
+		if(sequence & 1) continue;
+		if(!valid_record(record)) return NULL;	//Rewritten by store_thumbnail() if it is really the record
+		if(record->mtime != (int64_t) info.st_mtime || record->size != (int64_t) info.st_size)
+			return NULL;	//Source changed since, store_thumbnail() will overwrite the record
+		thumb = malloc(sizeof(Triple));
+		thumb->width = record->width;	//Checked values, the size below comes from the copy
+		thumb->height = record->height;
+		thumb->texture_pixels = malloc((size_t) thumb->width * (size_t) thumb->height * 3);
+		memcpy(thumb->texture_pixels, thumb_db.pixels + (size_t) number * THUMB_DB_BYTES,
+				(size_t) thumb->width * (size_t) thumb->height * 3);
+		memory_barrier();
+		if(record->sequence == sequence){
+			atomic_increment(&thumb_db.hits);
+			return thumb;
+		}
+		free_triple(thumb);
+	}
+	return NULL;
+}
+
+void store_thumbnail(char* path, Triple* thumb){	//Add or refresh a record, readers never block on this
+	struct stat info;
+	ThumbDbRecord* record;
+	char key[THUMB_DB_PATH];
+	uint64_t hash;
+	int number, added = 0;
+	if(thumb_db.map.base == NULL || !thumb_db_key(path, key) || stat(key, &info) != 0) return;
+	hash = hash_path(key);
+	atomic_increment(&thumb_db.misses);
+	mutex_lock(&thumb_db.write_lock);
+	if((number = find_record(hash, key)) < 0){
+		if(thumb_db.header->record_count == thumb_db.header->record_capacity){	//Full until the next rebuild
+			mutex_unlock(&thumb_db.write_lock);
+			return;
+		}
+		number = thumb_db.header->record_count;
+		added = 1;
+	}
+	record = &thumb_db.records[number];
+	record->sequence++;	//Odd, readers back off
+	memory_barrier();
+	record->width = thumb->width;
+	record->height = thumb->height;
+	record->mtime = info.st_mtime;
+	record->size = info.st_size;
+	record->hash = hash;
+	strcpy(record->path, key);
+	memcpy(thumb_db.pixels + (size_t) number * THUMB_DB_BYTES, thumb->texture_pixels,
+			(size_t) thumb->width * (size_t) thumb->height * 3);
+	memory_barrier();
+	record->sequence++;
+	if(added){
+		thumb_db.header->record_count++;
+		insert_record(hash, number);
+	}
+	mutex_unlock(&thumb_db.write_lock);
+}
+//-------------------------------------
 
-	return myTexture;	//Return texture descriptor
-	//-------------------------------------
+//Contact sheet -----------------------------
+
+Triple* decode_thumbnail(FILE* ppm){	//Decode at most THUMB_SIZE on a side, P6 files only read a few rows per
+	Triple* thumb = malloc(sizeof(Triple));	//thumbnail row
+	int source_width, source_height, thumb_width, thumb_height, magic, x, y, sample, thumb_row;
+	size_t pixel_bytes, sums_offset;
+	double header_width, header_height;
+	unsigned int* sums;
+	GLubyte* row;
+	long long data_start;
+	
+	if(thumb == NULL)
+		decode_error("Error: Out of memory decoding a thumbnail\n");
+	thumb->texture_pixels = NULL;
+	decode_partial = thumb;	//Freed by read_ppm_thumbnail() if anything below fails
+	skip_comts_ws(ppm);
+	expect_c(ppm, 'P');
+	magic = next_c(ppm);
+	if(magic != '3' && magic != '6')
+		decode_error("Error: Incorrect ppm file number on line %d\n", line);
+	skip_comts_ws(ppm);
+	header_width = next_number(ppm);
+	skip_comts_ws(ppm);
+	header_height = next_number(ppm);
+	check_image_size(header_width, header_height);
+	source_width = (int) header_width;
+	source_height = (int) header_height;
+	skip_comts_ws(ppm);
+	if(next_number(ppm) != 255)
+		decode_error("Error: Incorrect alpha value at line %d\n", line);
+	if(magic == '6' && !isspace(next_c(ppm)))
+		decode_error("Error: There must be one whitespace after the alpha field, line %d\n", line);
+	data_start = ftell64(ppm);
+	
+	if(source_width >= source_height){	//Keep the aspect ratio, never enlarge
+		thumb_width = source_width < THUMB_SIZE ? source_width : THUMB_SIZE;
+		thumb_height = (int) ((double) source_height * thumb_width / source_width + 0.5);
+	}else{
+		thumb_height = source_height < THUMB_SIZE ? source_height : THUMB_SIZE;
+		thumb_width = (int) ((double) source_width * thumb_height / source_height + 0.5);
+	}
+	thumb_width = thumb_width > 0 ? thumb_width : 1;
+	thumb_height = thumb_height > 0 ? thumb_height : 1;
+	thumb->width = thumb_width;
+	thumb->height = thumb_height;
+	pixel_bytes = (size_t) thumb_width * thumb_height * 3;	//One block holds the pixels, then the column sums and
+	sums_offset = (pixel_bytes + 7) & ~(size_t) 7;			//one source row, so a failed decode frees it all
+	thumb->texture_pixels = malloc(sums_offset + sizeof(unsigned int) * thumb_width * 4 + (size_t) source_width * 3);
+	if(thumb->texture_pixels == NULL)
+		decode_error("Error: Out of memory decoding a thumbnail\n");
+	sums = (unsigned int*) (thumb->texture_pixels + sums_offset);	//RGB and sample count per thumbnail column
+	row = (GLubyte*) (sums + thumb_width * 4);
+	
+	y = 0;	//Next source row a P3 file will yield
+	for(thumb_row = 0; thumb_row < thumb_height; thumb_row++){
+		int first = (int) ((long long) thumb_row * source_height / thumb_height);
+		int last = (int) ((long long) (thumb_row + 1) * source_height / thumb_height);
+		int samples = last - first < THUMB_ROW_SAMPLES ? last - first : THUMB_ROW_SAMPLES;
+		GLubyte* out = thumb->texture_pixels + (size_t) thumb_row * thumb_width * 3;
+		if(samples < 1) samples = 1;
+		memset(sums, 0, sizeof(unsigned int) * thumb_width * 4);
+		for(sample = 0; sample < samples; sample++){
+			int source_row = first + (2 * sample + 1) * (last - first) / (2 * samples);	//Evenly inside the block
+			if(source_row >= source_height) source_row = source_height - 1;
+			if(magic == '6'){	//Seek straight to the row
+				fseek64(ppm, data_start + (long long) source_row * source_width * 3, SEEK_SET);
+				if(fread(row, 3, source_width, ppm) != (size_t) source_width)
+					decode_error("Error: Unexpected end of file at row %d\n", source_row);
+			}else{	//Text has no fixed row size, parse up to the row
+				for(; y <= source_row; y++){
+					for(x = 0; x < source_width * 3; x++){
+						skip_ws(ppm);
+						row[x] = (int) next_number(ppm);
+					}
+				}
+			}
+			for(x = 0; x < source_width; x++){	//Box average the columns of each thumbnail pixel
+				unsigned int* sum = sums + (size_t) x * thumb_width / source_width * 4;
+				sum[0] += row[x * 3];
+				sum[1] += row[x * 3 + 1];
+				sum[2] += row[x * 3 + 2];
+				sum[3]++;
+			}
+		}
+		for(x = 0; x < thumb_width; x++){
+			unsigned int* sum = sums + x * 4;
+			unsigned int count = sum[3] > 0 ? sum[3] : 1;
+			out[x * 3] = (sum[0] + count / 2) / count;
+			out[x * 3 + 1] = (sum[1] + count / 2) / count;
+			out[x * 3 + 2] = (sum[2] + count / 2) / count;
+		}
+	}
+	row = realloc(thumb->texture_pixels, pixel_bytes);	//Give back the scratch space, shrinking keeps the pixels
+	if(row != NULL) thumb->texture_pixels = row;
+	decode_partial = NULL;
+	return thumb;
 }
 
-void bind_buffer(){	//Create new buffer, bind, and send it
-	GLuint vertex_buffer;
-	GLuint index_buffer;
-	// Create Buffer
-	glGenBuffers(1, &vertex_buffer);
+Triple* read_ppm_thumbnail(char* path){	//decode_thumbnail() of a file, NULL after reporting one that cannot be read
+	FILE* ppm = fopen(path, "rb");
+	jmp_buf recovery;
+	Triple* thumb;
+	if(ppm == NULL){
+		fprintf(stderr, "Error: Could not open %s\n", path);
+		return NULL;
+	}
+	if(setjmp(recovery) == 0){
+		decode_recovery = &recovery;
+		line = 1;
+		thumb = decode_thumbnail(ppm);
+	}else{	//decode_error() has already said what was wrong
+		fprintf(stderr, "Warning: Could not decode a thumbnail of %s\n", path);
+		free_triple(decode_partial);
+		decode_partial = NULL;
+		thumb = NULL;
+	}
+	decode_recovery = NULL;
+	fclose(ppm);
+	return thumb;
+}
 
-	// Map GL_ARRAY_BUFFER to this buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+Triple* placeholder_thumbnail(){	//Cell for a file that could not be decoded, grey with a cross
+	Triple* thumb = malloc(sizeof(Triple));
+	int x, y;
+	thumb->width = thumb->height = THUMB_SIZE;
+	thumb->texture_pixels = malloc(THUMB_SIZE * THUMB_SIZE * 3);
+	for(y = 0; y < THUMB_SIZE; y++)
+		for(x = 0; x < THUMB_SIZE; x++)
+			memset(thumb->texture_pixels + (y * THUMB_SIZE + x) * 3, abs(x - y) < 2 || abs(x + y - THUMB_SIZE + 1) < 2 ? 160 : 64, 3);
+	return thumb;
+}
 
-	// Send the data
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertices), Vertices, GL_STATIC_DRAW);
+void thumbnail_task(void* arg, int worker){	//Decode one thumbnail for the sheet
+	int index = (int) (size_t) arg;
+	Triple* pixels = lookup_thumbnail(browser.names[index]);
+	if(pixels == NULL){	//Not stored yet, or the file changed
+		pixels = read_ppm_thumbnail(browser.names[index]);
+		if(pixels != NULL)
+			store_thumbnail(browser.names[index], pixels);
+		else	//Not stored, so the file is tried again once it is fixed
+			pixels = placeholder_thumbnail();
+	}
+	mutex_lock(&sheet.lock);
+	sheet.thumbs[index].pixels = pixels;
+	mutex_unlock(&sheet.lock);
+	glfwPostEmptyEvent();	//Wake the render loop so pack_thumbnails() can place it
+}
 
-	glGenBuffers(1, &index_buffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Indices), Indices, GL_STATIC_DRAW);
+void start_sheet(){	//Queue every thumbnail on the work stealing pool, once
+	int i;
+	if(sheet.thumbs != NULL) return;
+	sheet.count = browser.count < SHEET_MAX ? browser.count : SHEET_MAX;
+	sheet.thumbs = calloc(sheet.count, sizeof(Thumbnail));
+	mutex_init(&sheet.lock);
+	sheet.view.scale = sheet.view.stretch_y = 1;
+	glGenBuffers(1, &sheet.vertex_buffer);
+	glGenBuffers(1, &sheet.index_buffer);
+	if(thumb_db.path != NULL)
+		open_thumb_db(sheet.count);
+	start_stealing_pool();
+	for(i = sheet.count - 1; i >= 0; i--){	//Workers run their newest task first, so the top of the sheet comes first
+		sheet.thumbs[i].atlas = -1;
+		submit_task(-1, thumbnail_task, (void*) (size_t) i);
+	}
 }
 
-VariableArray* get_shader_variables(GLint program_id){	//Retrieve shader variable locations
-	VariableArray* our_variables = malloc(sizeof(VariableArray));
-	our_variables->mvp_slot = glGetUniformLocation(program_id, "MVP");
-	if(our_variables->mvp_slot == -1){	//If variable does not exist in shader, throw error
-		fprintf(stderr, "Error: Could not find MVP matrix");
+int place_thumbnail(Thumbnail* thumb){	//Shelf pack into the newest atlas, opening a shelf or atlas when full
+	if(sheet.shelf_x + thumb->width > ATLAS_SIZE){	//Next shelf
+		sheet.shelf_y += sheet.shelf_height + 1;
+		sheet.shelf_x = 0;
+		sheet.shelf_height = 0;
+	}
+	if(sheet.atlas_count == 0 || sheet.shelf_y + thumb->height > ATLAS_SIZE){	//Next atlas
+		if(sheet.atlas_count == MAX_ATLASES) return 0;
+		glGenTextures(1, &sheet.atlases[sheet.atlas_count]);
+		cached_bind_texture(sheet.atlases[sheet.atlas_count]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, ATLAS_SIZE, ATLAS_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		sheet.atlas_count++;
+		sheet.shelf_x = sheet.shelf_y = sheet.shelf_height = 0;
+	}
+	thumb->atlas = sheet.atlas_count - 1;
+	thumb->x = sheet.shelf_x;
+	thumb->y = sheet.shelf_y;
+	sheet.shelf_x += thumb->width + 1;	//A texel of gap keeps linear filtering from bleeding across
+	if(thumb->height > sheet.shelf_height) sheet.shelf_height = thumb->height;
+	return 1;
+}
+
+void pack_thumbnails(){	//Upload thumbnails the workers finished into the atlases
+	int i, packed = 0;
+	mutex_lock(&sheet.lock);
+	for(i = 0; i < sheet.count; i++){
+		Thumbnail* thumb = &sheet.thumbs[i];
+		if(thumb->pixels == NULL || thumb->atlas != -1) continue;
+		thumb->width = thumb->pixels->width;
+		thumb->height = thumb->pixels->height;
+		if(place_thumbnail(thumb)){
+			cached_bind_texture(sheet.atlases[thumb->atlas]);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, thumb->x, thumb->y, thumb->width, thumb->height, GL_RGB,
+							GL_UNSIGNED_BYTE, thumb->pixels->texture_pixels);
+			packed++;
+		}
+		free_triple(thumb->pixels);
+		thumb->pixels = NULL;
+	}
+	mutex_unlock(&sheet.lock);
+	if(packed > 0){
+		sheet.layout_width = 0;
+		needs_redraw = 1;
+	}
+}
+
+void layout_sheet(){	//One quad per packed thumbnail in a grid across the window, indices grouped by atlas
+	int cell = THUMB_SIZE + 2 * SHEET_MARGIN;
+	int columns = width / cell > 0 ? width / cell : 1;
+	Vertex* vertices = calloc((size_t) sheet.count * 4, sizeof(Vertex));
+	GLushort* indices = malloc(sizeof(GLushort) * 6 * sheet.count);
+	int atlas, i, index_count = 0;
+	
+	for(i = 0; i < sheet.count; i++){	//Cells in list order, thumbnails centred in them
+		Thumbnail* thumb = &sheet.thumbs[i];
+		Vertex* quad = vertices + i * 4;
+		float left, top, right, bottom;
+		if(thumb->atlas == -1) continue;
+		left = (i % columns) * cell + (width - columns * cell) / 2 + (cell - thumb->width) / 2;
+		top = (i / columns) * cell + (cell - thumb->height) / 2;
+		right = left + thumb->width;
+		bottom = top + thumb->height;
+		memcpy(quad, Vertices, sizeof(Vertices));
+		quad[0].position[0] = quad[3].position[0] = -1 + 2 * left / width;	//Pixels to clip space
+		quad[1].position[0] = quad[2].position[0] = -1 + 2 * right / width;
+		quad[0].position[1] = quad[1].position[1] = 1 - 2 * top / height;
+		quad[2].position[1] = quad[3].position[1] = 1 - 2 * bottom / height;
+		quad[0].texcoord[0] = quad[3].texcoord[0] = (float) thumb->x / ATLAS_SIZE;
+		quad[1].texcoord[0] = quad[2].texcoord[0] = (float) (thumb->x + thumb->width) / ATLAS_SIZE;
+		quad[0].texcoord[1] = quad[1].texcoord[1] = (float) thumb->y / ATLAS_SIZE;
+		quad[2].texcoord[1] = quad[3].texcoord[1] = (float) (thumb->y + thumb->height) / ATLAS_SIZE;
+	}
+	for(atlas = 0; atlas < sheet.atlas_count; atlas++){	//Each atlas is then one draw call
+		int first = index_count;
+		for(i = 0; i < sheet.count; i++){
+			int k;
+			if(sheet.thumbs[i].atlas != atlas) continue;
+			for(k = 0; k < 6; k++)
+				indices[index_count++] = i * 4 + Indices[k];
+		}
+		sheet.index_counts[atlas] = index_count - first;
+	}
+	cached_bind_buffer(GL_ARRAY_BUFFER, sheet.vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * 4 * sheet.count, vertices, GL_STATIC_DRAW);
+	cached_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, sheet.index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * index_count, indices, GL_STATIC_DRAW);
+	free(vertices);
+	free(indices);
+	sheet.layout_width = width;
+}
+
+void draw_sheet(VariableArray* our_variables){	//Every thumbnail, in one draw call per atlas
+	int atlas, first = 0;
+	if(sheet.layout_width != width)
+		layout_sheet();
+	cached_use_program(our_variables->program_id);
+	cached_uniform_matrix(our_variables->mvp_slot, (const GLfloat*) mvp);
+	cached_bind_buffer(GL_ARRAY_BUFFER, sheet.vertex_buffer);
+	if(!state_unchanged(gl_state.attribute_buffer == sheet.vertex_buffer)){
+		set_vertex_attributes(our_variables);
+		gl_state.attribute_buffer = sheet.vertex_buffer;
+	}
+	cached_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, sheet.index_buffer);
+	for(atlas = 0; atlas < sheet.atlas_count; atlas++){
+		cached_bind_texture(sheet.atlases[atlas]);
+		note_gl_call();
+		glDrawElements(GL_TRIANGLES, sheet.index_counts[atlas], GL_UNSIGNED_SHORT,
+						(GLvoid*) (sizeof(GLushort) * first));
+		first += sheet.index_counts[atlas];
+	}
+}
+
+void toggle_sheet(){	//Switch between the current image and the contact sheet, each keeping its own view
+	ViewState image_view = view;
+	start_sheet();
+	view = sheet.view;
+	sheet.view = image_view;
+	view_dirty = 1;
+	clear_history();	//Steps belong to the view that was left
+	sheet.active = !sheet.active;
+	needs_redraw = 1;
+}
+
+void render_sheet_frame(VariableArray* our_variables){	//render_frame() for the contact sheet
+	update_mvp();
+	cached_clear_color(0, 104.0/255.0, 55.0/255.0, 1.0);
+	note_gl_call();
+	glClear(GL_COLOR_BUFFER_BIT);
+	draw_sheet(our_variables);
+	if(show_overlay)
+		draw_overlay(our_variables);
+	end_gpu_timer();
+}
+//-------------------------------------
+
+//Headless rendering -----------------------------
+
+EGLDisplay open_headless_display(){	//Find an EGL display that needs no window system
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	const char* client_extensions;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+	
+	if(display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+		return display;
+	//No display server, ask Mesa for a surfaceless platform (llvmpipe works here)
+	client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(client_extensions == NULL || strstr(client_extensions, "EGL_MESA_platform_surfaceless") == NULL ||
+			get_platform_display == NULL)
+		return EGL_NO_DISPLAY;
+	display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if(display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+		return display;
+	return EGL_NO_DISPLAY;
+}
+
+void create_headless_context(){	//Make an OpenGL ES 2 context current on a pbuffer, or on no surface at all
+	EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	EGLint pbuffer_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};	//Drawing goes to an FBO
+	EGLint context_attributes[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+	EGLDisplay display = open_headless_display();
+	EGLSurface surface = EGL_NO_SURFACE;
+	EGLConfig config;
+	EGLContext context;
+	EGLint config_count = 0;
+	
+	if(display == EGL_NO_DISPLAY){
+		fprintf(stderr, "Error: Could not open an EGL display for headless rendering\n");
 		exit(1);
 	}
-	our_variables->position_slot = glGetAttribLocation(program_id, "Position");
-	if(our_variables->position_slot == -1){
-		fprintf(stderr, "Error: Could not find position vector");
+	eglBindAPI(EGL_OPENGL_ES_API);
+	if(eglChooseConfig(display, config_attributes, &config, 1, &config_count) && config_count > 0){
+		surface = eglCreatePbufferSurface(display, config, pbuffer_attributes);
+	}else{	//Surfaceless displays have no pbuffer configs
+		config_attributes[1] = 0;
+		if(!eglChooseConfig(display, config_attributes, &config, 1, &config_count) || config_count == 0){
+			fprintf(stderr, "Error: No EGL config for OpenGL ES 2\n");
+			exit(1);
+		}
+	}
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+	if(context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)){
+		fprintf(stderr, "Error: Could not make a headless EGL context current (0x%x)\n", eglGetError());
 		exit(1);
 	}
-	our_variables->color_slot = glGetAttribLocation(program_id, "SourceColor");
-	if(our_variables->color_slot == -1){
-		fprintf(stderr, "Error: Could not find color vector");
+}
+
+GLuint create_framebuffer(int fb_width, int fb_height){	//Offscreen RGBA render target
+	GLuint framebuffer, color;
+	glGenTextures(1, &color);
+	cached_bind_texture(color);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, fb_width, fb_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+		fprintf(stderr, "Error: Offscreen framebuffer is incomplete\n");
 		exit(1);
 	}
-	our_variables->texture_slot = glGetAttribLocation(program_id, "TexCoordIn");
-	if(our_variables->texture_slot == -1){
-		fprintf(stderr, "Error: Could not find texture coordinates");
+	return framebuffer;
+}
+
+Triple* read_framebuffer(){	//Copy the current framebuffer into an image, top row first
+	Triple* frame = malloc(sizeof(Triple));
+	GLubyte* rgba = malloc((size_t) width * height * 4);
+	int x, y;
+	frame->width = width;
+	frame->height = height;
+	frame->texture_pixels = malloc((size_t) width * height * 3);
+	if(rgba == NULL || frame->texture_pixels == NULL){
+		fprintf(stderr, "Error: Out of memory reading back the frame\n");
 		exit(1);
 	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);	//Only RGBA is guaranteed
+	for(y = 0; y < height; y++){	//GL rows start at the bottom
+		GLubyte* in = rgba + (size_t) (height - 1 - y) * width * 4;
+		GLubyte* out = frame->texture_pixels + (size_t) y * width * 3;
+		for(x = 0; x < width; x++){
+			out[x * 3] = in[x * 4];
+			out[x * 3 + 1] = in[x * 4 + 1];
+			out[x * 3 + 2] = in[x * 4 + 2];
+		}
+	}
+	free(rgba);
+	return frame;
+}
+
+int run_headless(Triple* texture_struct, char* output_name){	//Render into an FBO without a window and save a PPM
+	VariableArray* our_variables;
+	GLuint myTexture, vertex_buffer;
+	double total = 0, slowest = 0, fastest = 0;
+	Triple* frame;
+	int i;
 	
-	glEnableVertexAttribArray(our_variables->position_slot);	//Enable attribute variables
-	glEnableVertexAttribArray(our_variables->color_slot);
-	glEnableVertexAttribArray(our_variables->texture_slot);
+	create_headless_context();
+	create_framebuffer(width, height);
+	our_variables = setup_renderer(texture_struct, &myTexture, &vertex_buffer);
+	cached_viewport(0, 0, width, height);
 	
-	our_variables->textureUniform = glGetUniformLocation(program_id, "Texture");
-	if(our_variables->textureUniform == -1){
-		fprintf(stderr, "Error: Could not find texture uniform");
+	for(i = 0; i < headless_frames; i++){	//glFinish stands in for the swap so each frame is fully timed
+		double swap_start, elapsed;
+		long scope = trace_begin("frame", "frame");
+		begin_frame_metrics();
+		render_frame(vertex_buffer, myTexture, our_variables);
+		swap_start = now_seconds();
+		glFinish();
+		end_frame_metrics(swap_start, now_seconds());
+		trace_end(scope);
+		elapsed = now_seconds() - frame_start;
+		total += elapsed;
+		if(i == 0 || elapsed > slowest) slowest = elapsed;
+		if(i == 0 || elapsed < fastest) fastest = elapsed;
+	}
+	finish_metrics();
+	
+	frame = read_framebuffer();
+	write_ppm_file(output_name, frame);
+	free_triple(frame);
+	printf("%dx%d, %d frames: mean %.3f ms, min %.3f ms, max %.3f ms\n", width, height, headless_frames,
+			total * 1000 / headless_frames, fastest * 1000, slowest * 1000);
+	return EXIT_SUCCESS;
+}
+//-------------------------------------
+
+//Compare -----------------------------
+
+#define COMPARE_WIDTH 1024	//Both paths render every view at this size
+#define COMPARE_HEIGHT 768
+#define COMPARE_RUNS 3		//Renders per path and view, the fastest is reported
+
+Triple* generate_image(int image_width, int image_height){	//Gradients, fine checks and hard edged rings
+	Triple* image = malloc(sizeof(Triple));
+	int x, y;
+	image->width = image_width;
+	image->height = image_height;
+	image->texture_pixels = malloc((size_t) image_width * image_height * 3);
+	if(image->texture_pixels == NULL){
+		fprintf(stderr, "Error: Out of memory generating a %dx%d image\n", image_width, image_height);
 		exit(1);
 	}
-	return our_variables;	//Return struct of all variable locations
+	for(y = 0; y < image_height; y++){
+		GLubyte* out = image->texture_pixels + (size_t) y * image_width * 3;
+		for(x = 0; x < image_width; x++, out += 3){
+			int dx = x - image_width / 2, dy = y - image_height / 2;
+			int ring = (int) sqrtf((float) dx * dx + (float) dy * dy) / 40 % 2;
+			out[0] = x * 255 / (image_width - 1);
+			out[1] = ring ? 230 : y * 255 / (image_height - 1);
+			out[2] = ((x >> 3) ^ (y >> 3)) & 1 ? 200 : 40;
+		}
+	}
+	return image;
 }
 
-Triple* read_p3_file(FILE* ppm){	//Read p3 file and store in GLubyte array
-	double width, height, alpha;
-	Triple* texture_struct = malloc(sizeof(Triple));
-	int i, j;
-	GLubyte* texture_pixels;
-	
-	skip_comts_ws(ppm);	//Skip comments and whitespace at the beginning of the file
-	width = next_number(ppm);	//Grab width value
+double compare_images(Triple* a, Triple* b, int* max_difference){	//PSNR in dB, infinite if identical
+	size_t i, size = (size_t) a->width * (size_t) a->height * 3;
+	double squared = 0;
+	*max_difference = 0;
+	for(i = 0; i < size; i++){
+		int difference = abs(a->texture_pixels[i] - b->texture_pixels[i]);
+		if(difference > *max_difference) *max_difference = difference;
+		squared += difference * difference;
+	}
+	if(squared == 0) return INFINITY;
+	return 10 * log10(255.0 * 255.0 * size / squared);
+}
+
+int compare_image(FILE* results, char* name, Triple* image, double load_ms){	//Every view and filter of one image
+	static VariableArray* our_variables = NULL;
+	static GLuint myTexture, vertex_buffer;
+	Triple cpu_frame;
+	double start, upload_ms;
+	int view, filter, run, failed = 0;
 	
-	skip_comts_ws(ppm);	//Skip more comments and whitespace
-	height = next_number(ppm);	//Grab height value
+	start = now_seconds();
+	if(our_variables == NULL){	//First image sets up the programs as well
+		our_variables = setup_renderer(image, &myTexture, &vertex_buffer);
+	}else{
+		forget_texture(myTexture);
+		glDeleteTextures(1, &myTexture);
+		myTexture = new_texture(image);
+	}
+	glFinish();
+	upload_ms = (now_seconds() - start) * 1000;
 	
-	texture_struct->width = width;	//Store width and height into our struct
-	texture_struct->height = height;
-	texture_pixels = malloc(sizeof(GLubyte) * width * height * 3);
+	cpu_frame.width = COMPARE_WIDTH;
+	cpu_frame.height = COMPARE_HEIGHT;
+	cpu_frame.texture_pixels = malloc((size_t) COMPARE_WIDTH * COMPARE_HEIGHT * 3);
+	if(cpu_frame.texture_pixels == NULL){
+		fprintf(stderr, "Error: Out of memory for the compare framebuffer\n");
+		exit(1);
+	}
+	for(view = 0; view < sizeof(CompareViews) / sizeof(CompareView); view++){
+		memcpy(transform_options, CompareViews[view].steps, sizeof(CompareViews[view].steps));
+		transform_option_count = CompareViews[view].step_count;
+		reset_view();
+		apply_transform_options();
+		update_mvp();
+		for(filter = 0; filter < FILTER_COUNT; filter++){
+			double gpu_ms = 0, readback_ms, cpu_ms = 0, psnr;
+			double tolerance = compare_tolerance > 0 ? compare_tolerance : FilterTolerances[filter];
+			int max_difference, passed;
+			Triple* gpu_frame;
+			resample_filter = filter;
+			for(run = 0; run < COMPARE_RUNS; run++){	//glFinish makes the GPU time the whole frame
+				double elapsed;
+				begin_frame_metrics();
+				render_frame(vertex_buffer, myTexture, our_variables);
+				glFinish();
+				end_frame_metrics(now_seconds(), now_seconds());
+				elapsed = (now_seconds() - frame_start) * 1000;
+				if(run == 0 || elapsed < gpu_ms) gpu_ms = elapsed;
+			}
+			start = now_seconds();
+			gpu_frame = read_framebuffer();
+			readback_ms = (now_seconds() - start) * 1000;
+			for(run = 0; run < COMPARE_RUNS; run++){
+				double elapsed;
+				start = now_seconds();
+				render_software(image, &cpu_frame, &view_transform, 1, 0);
+				elapsed = (now_seconds() - start) * 1000;
+				if(run == 0 || elapsed < cpu_ms) cpu_ms = elapsed;
+			}
+			psnr = compare_images(gpu_frame, &cpu_frame, &max_difference);
+			passed = psnr >= tolerance;
+			fprintf(results, "%s,%d,%d,%s,%s,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%d,%s\n", name, (int) image->width,
+					(int) image->height, CompareViews[view].name, FilterNames[filter], load_ms, upload_ms, gpu_ms,
+					readback_ms, cpu_ms, isinf(psnr) ? 999.0 : psnr, max_difference, passed ? "pass" : "fail");
+			if(!passed){
+				printf("FAIL %s %s %s: %.2f dB, max difference %d\n", name, CompareViews[view].name,
+						FilterNames[filter], psnr, max_difference);
+				failed++;
+			}
+			free_triple(gpu_frame);
+		}
+	}
+	free(cpu_frame.texture_pixels);
+	return failed;	//Number of views and filters that disagreed
+}
+
+int run_compare(char* input_name){	//Golden image check of the GPU path against the CPU path, with timings
+	FILE* results = fopen(compare_output, "w");
+	char** names = NULL;
+	int count = 1, i, failed = 0, compared = 0;
 	
-	skip_comts_ws(ppm);	//You know what this does
-	if((alpha = next_number(ppm)) != 255){	//Grab alpha value, make sure it is valid
-		fprintf(stderr, "Error: Incorrect alpha value at line %d", line);
+	if(results == NULL){
+		fprintf(stderr, "Error: Could not open %s for writing\n", compare_output);
 		exit(1);
 	}
-	skip_comts_ws(ppm);
+	if(is_directory(input_name)){
+		names = list_ppm_files(input_name, &count);
+		if(count == 0){
+			fprintf(stderr, "Error: No .ppm files in %s\n", input_name);
+			exit(1);
+		}
+	}
+	fprintf(results, "image,width,height,view,filter,load_ms,upload_ms,gpu_ms,readback_ms,cpu_ms,psnr_db,max_diff,result\n");
+	width = COMPARE_WIDTH;	//The transform functions and read_framebuffer() use these
+	height = COMPARE_HEIGHT;
+	magnify_nearest = 0;	//The magnified views are there to test the filters
+	create_headless_context();
+	create_framebuffer(width, height);
+	cached_viewport(0, 0, width, height);
 	
-	for(i = 0; i < height; i++){	//Iterate through file and store pixel info into GLubyte array
-		for(j = 0; j < width; j++){
-			texture_pixels[(int)(j + width * i) * 3] = (int) next_number(ppm);
-			skip_ws(ppm);
-			texture_pixels[(int)(j + width * i) * 3 + 1] = (int) next_number(ppm);
-			skip_ws(ppm);
-			texture_pixels[(int)(j + width * i) * 3 + 2] = (int) next_number(ppm);
-			if(i == width - 1 && j == height - 1) continue;
-			skip_ws(ppm);
+	for(i = 0; i < count + (int) (sizeof(GeneratedSizes) / sizeof(GeneratedSizes[0])); i++){
+		char generated_name[64];
+		char* path = NULL;
+		char* name;
+		Triple* image;
+		double start = now_seconds();
+		if(i < count){	//Files first, then the synthetic images
+			path = names != NULL ? join_path(input_name, names[i]) : input_name;
+			name = names != NULL ? names[i] : input_name;
+			image = read_ppm_file(path);
+		}else{
+			snprintf(generated_name, sizeof(generated_name), "generated-%dx%d", GeneratedSizes[i - count][0],
+					GeneratedSizes[i - count][1]);
+			name = generated_name;
+			image = generate_image(GeneratedSizes[i - count][0], GeneratedSizes[i - count][1]);
 		}
+		failed += compare_image(results, name, image, (now_seconds() - start) * 1000);
+		compared += sizeof(CompareViews) / sizeof(CompareView) * FILTER_COUNT;
+		free_triple(image);
+		if(names != NULL && path != NULL) free(path);
 	}
-	texture_struct->texture_pixels = texture_pixels;	//Store GLubyte array into struct
-	return texture_struct;	//return struct
+	fclose(results);
+	printf("%d of %d comparisons within tolerance, results in %s\n", compared - failed, compared, compare_output);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+//-------------------------------------
 
-Triple* read_p6_file(FILE* ppm){	//Read p6 file and store in GLubyte array
-	double width, height, alpha;
-	Triple* texture_struct = malloc(sizeof(Triple));
-	int i, j, c;
-	GLubyte* texture_pixels;
+//Benchmarks -----------------------------
+
+#define BENCHMARK_ROUNDS 2000000
+#define BENCHMARK_POINTS 1024	//Points per batch apply
+#define DECODE_ROUNDS 3			//Decodes of each corpus image per decoder
+#define DENSE_COMMENTS 1000		//Header comment lines in the comment heavy corpus images
+
+enum {SPACING_SPACES, SPACING_LINES, SPACING_MIXED};	//How the corpus separates P3 values
+
+typedef struct{		//This struct describes one kind of image in the decode benchmark corpus
+	const char* name;
+	int raw;		//P6 if set, P3 otherwise
+	int odd;		//One column more than the even width
+	int comments;	//Header comment lines
+	int spacing;	//Separators between P3 values
+} CorpusCase;
+
+const CorpusCase DecodeCorpus[] = {
+	{"P6", 1, 0, 1, SPACING_SPACES},
+	{"P6 odd width", 1, 1, 1, SPACING_SPACES},
+	{"P6 dense comments", 1, 0, DENSE_COMMENTS, SPACING_SPACES},
+	{"P3 spaces", 0, 0, 1, SPACING_SPACES},
+	{"P3 value per line", 0, 0, 1, SPACING_LINES},
+	{"P3 tabs and CRLF", 0, 0, 1, SPACING_MIXED},
+	{"P3 odd width", 0, 1, 1, SPACING_SPACES},
+	{"P3 dense comments", 0, 0, DENSE_COMMENTS, SPACING_SPACES},
+};
+
+void report_benchmark(const char* name, double affine_seconds, double linmath_seconds, long operations){
+	printf("%-24s affine %7.2f ns   linmath %7.2f ns   %5.2fx\n", name, affine_seconds * 1e9 / operations,
+			linmath_seconds * 1e9 / operations, linmath_seconds / affine_seconds);
+}
+
+int run_affine_benchmark(){	//Time the Affine operations against the linmath calls they replaced, each result feeds
+	Affine step = {{cosf(0.01f), sinf(0.01f), -sinf(0.01f), cosf(0.01f)}, {0.001f, -0.002f}};	//the next so
+	Affine affine = step;																		//nothing is skipped
+	mat4x4 step_matrix, matrix;
+	float* points = malloc(BENCHMARK_POINTS * 2 * sizeof(float));
+	vec4 vector = {0.5f, 0.25f, 0, 1}, mapped;
+	float point[2] = {0.5f, 0.25f};
+	double start, affine_time, linmath_time, checksum = 0;
+	int i, j;
 	
-	skip_comts_ws(ppm);	//Skip comments and whitespace
-	width = next_number(ppm);	//Grab width value
+	if(points == NULL){
+		fprintf(stderr, "Error: Out of memory for the benchmark points\n");
+		exit(1);
+	}
+	affine_to_mat4x4(step_matrix, &step);
+	mat4x4_dup(matrix, step_matrix);
 	
-	skip_comts_ws(ppm);
-	height = next_number(ppm);	//Grab height value
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS; i++)
+		affine_compose(&affine, &affine, &step);
+	affine_time = now_seconds() - start;
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS; i++)
+		mat4x4_mul(matrix, matrix, step_matrix);
+	linmath_time = now_seconds() - start;
+	report_benchmark("compose", affine_time, linmath_time, BENCHMARK_ROUNDS);
+	checksum += affine.linear[0] + matrix[0][0];
 	
-	texture_struct->width = width;	//Store width and height values into struct
-	texture_struct->height = height;
-	texture_pixels = malloc(sizeof(GLubyte) * width * height * 3);
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS; i++)
+		affine_invert(&affine, &affine);
+	affine_time = now_seconds() - start;
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS; i++){
+		mat4x4 inverse;
+		mat4x4_invert(inverse, matrix);
+		mat4x4_dup(matrix, inverse);
+	}
+	linmath_time = now_seconds() - start;
+	report_benchmark("invert", affine_time, linmath_time, BENCHMARK_ROUNDS);
+	checksum += affine.offset[0] + matrix[3][0];
 	
-	skip_comts_ws(ppm);
-	if((alpha = next_number(ppm)) != 255){	//Grab alpha value and error check it
-		fprintf(stderr, "Error: Incorrect alpha value at line %d", line);
-		exit(1);
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS; i++)
+		affine_apply(&step, point[0], point[1], point);
+	affine_time = now_seconds() - start;
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS; i++){
+		mat4x4_mul_vec4(mapped, step_matrix, vector);
+		memcpy(vector, mapped, sizeof(vec4));
 	}
-	if(!isspace(next_c(ppm))){	//There must be exactly one whitespace between header and raw info
-		fprintf(stderr, "Error: There must be one whitespace after the alpha field, line %d", line);
+	linmath_time = now_seconds() - start;
+	report_benchmark("apply one point", affine_time, linmath_time, BENCHMARK_ROUNDS);
+	checksum += point[0] + vector[0];
+	
+	for(i = 0; i < BENCHMARK_POINTS * 2; i++)
+		points[i] = (i % 7) * 0.1f;
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS / BENCHMARK_POINTS; i++)
+		affine_apply_many(&step, points, points, BENCHMARK_POINTS);
+	affine_time = now_seconds() - start;
+	checksum += points[0];
+	for(i = 0; i < BENCHMARK_POINTS * 2; i++)
+		points[i] = (i % 7) * 0.1f;
+	start = now_seconds();
+	for(i = 0; i < BENCHMARK_ROUNDS / BENCHMARK_POINTS; i++)
+		for(j = 0; j < BENCHMARK_POINTS; j++){
+			vec4 in = {points[2 * j], points[2 * j + 1], 0, 1};
+			mat4x4_mul_vec4(mapped, step_matrix, in);
+			points[2 * j] = mapped[0];
+			points[2 * j + 1] = mapped[1];
+		}
+	linmath_time = now_seconds() - start;
+	report_benchmark("apply per point in batch", affine_time, linmath_time,
+						(long) (BENCHMARK_ROUNDS / BENCHMARK_POINTS) * BENCHMARK_POINTS);
+	checksum += points[0];
+	
+	printf("checksum %g\n", checksum);	//Uses every result
+	free(points);
+	return EXIT_SUCCESS;
+}
+
+void write_corpus_image(FILE* out, const CorpusCase* corpus, int image_width, int image_height){	//Noise, so
+	char* row = malloc((size_t) image_width * 3 * 6 + 2);	//every P3 value length turns up
+	unsigned state = 2463534242u;
+	int x, y, channel, i;
+	
+	if(row == NULL){
+		fprintf(stderr, "Error: Out of memory for the corpus rows\n");
 		exit(1);
 	}
-	
-	for(i = 0; i < height; i++){	//Iterate through file and store pixel info into GLubyte array
-		for(j = 0; j < width; j++){
-			texture_pixels[(int)(j + width * i) * 3] = next_c(ppm);
-			texture_pixels[(int)(j + width * i) * 3 + 1] = next_c(ppm);
-			texture_pixels[(int)(j + width * i) * 3 + 2] = next_c(ppm);
+	fprintf(out, "%s\n", corpus->raw ? "P6" : "P3");
+	for(i = 0; i < corpus->comments; i++)
+		fprintf(out, "# Comment %d of the ezview decode benchmark corpus, as long as the ones image editors write\n", i);
+	fprintf(out, "%d %d\n255\n", image_width, image_height);
+	for(y = 0; y < image_height; y++){
+		size_t length = 0;
+		for(x = 0; x < image_width; x++)
+			for(channel = 0; channel < 3; channel++){
+				unsigned value;
+				state ^= state << 13;	//xorshift32
+				state ^= state >> 17;
+				state ^= state << 5;
+				value = state >> 24;
+				if(corpus->raw){
+					row[length++] = (char) value;
+					continue;
+				}
+				if(value >= 100) row[length++] = '0' + value / 100;
+				if(value >= 10) row[length++] = '0' + value / 10 % 10;
+				row[length++] = '0' + value % 10;
+				if(corpus->spacing == SPACING_LINES)
+					row[length++] = '\n';
+				else if(corpus->spacing == SPACING_MIXED && channel < 2)
+					row[length++] = '\t';
+				else if(corpus->spacing == SPACING_MIXED && x < image_width - 1){
+					row[length++] = ' ';
+					row[length++] = ' ';
+				}else if(x < image_width - 1 || channel < 2)
+					row[length++] = ' ';
+			}
+		if(corpus->spacing == SPACING_MIXED)
+			row[length++] = '\r';
+		if(!corpus->raw && corpus->spacing != SPACING_LINES)
+			row[length++] = '\n';
+		if(fwrite(row, 1, length, out) != length){
+			fprintf(stderr, "Error: Could not write the corpus, out of disk space?\n");
+			exit(1);
 		}
 	}
+	free(row);
+}
+
+void reset_peak_rss(){	//Start a new peak, where the system allows it
+#ifdef __linux__
+	FILE* refs = fopen("/proc/self/clear_refs", "w");
+	if(refs != NULL){
+		fputs("5", refs);
+		fclose(refs);
+	}
+#endif
+}
+
+double peak_rss_megabytes(){	//Largest resident set since reset_peak_rss(), or since the start, -1 if unknown
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#elif defined(__linux__)
+	char text[256];
+	double kilobytes = -1;
+	FILE* status = fopen("/proc/self/status", "r");
+	while(status != NULL && fgets(text, sizeof(text), status) != NULL)
+		if(sscanf(text, "VmHWM: %lf", &kilobytes) == 1) break;
+	if(status != NULL) fclose(status);
+	if(kilobytes >= 0)
+		return kilobytes / 1024;
+#endif
+	return -1;
+}
+
+unsigned image_hash(Triple* image){	//FNV-1a over the pixels, to check the decoders agree without keeping both
+	size_t size = (size_t) image->width * image->height * 3, i;
+	unsigned hash = 2166136261u;
+	for(i = 0; i < size; i++)
+		hash = (hash ^ image->texture_pixels[i]) * 16777619u;
+	return hash;
+}
+
+int run_decode_benchmark(){	//Time the reference and fast decoders over a generated corpus of every size up to
+	const char* DecoderNames[2] = {"reference", "fast"};	//--decode-megapixels
+	int corpus_count = sizeof(DecodeCorpus) / sizeof(CorpusCase), scale, c, decoder, round;
 	
-	texture_struct->texture_pixels = texture_pixels;	//Store GLubyte array into struct
-	return texture_struct;	//return struct
+	printf("%-18s %11s %-9s %9s %9s %9s %9s %6s\n", "case", "size", "decoder", "MB/s", "MP/s", "best ms", "peak MB",
+			"allocs");
+	for(scale = 0; (1 << (2 * scale)) <= decode_megapixels; scale++)	//1, 4, 16... megapixels
+		for(c = 0; c < corpus_count; c++){
+			const CorpusCase* corpus = &DecodeCorpus[c];
+			int image_width = (1000 << scale) + corpus->odd, image_height = 1000 << scale;
+			unsigned reference_hash = 0;
+			double file_megabytes;
+			char size[32];
+			FILE* file = tmpfile();
+			
+			if(file == NULL){
+				fprintf(stderr, "Error: Could not create a temporary corpus file\n");
+				exit(1);
+			}
+			write_corpus_image(file, corpus, image_width, image_height);
+			fflush(file);
+			file_megabytes = ftell64(file) / (1024.0 * 1024.0);	//64 bit, long is 32 bits on Windows
+			sprintf(size, "%dx%d", image_width, image_height);
+			for(decoder = 0; decoder < 2; decoder++){
+				long allocations = decode_allocations;
+				double best = 0;
+				reset_peak_rss();
+				for(round = 0; round < DECODE_ROUNDS; round++){
+					Triple* image;
+					double start = now_seconds(), elapsed;
+					rewind(file);
+					line = 1;
+					skip_comts_ws(file);	//What read_ppm_file() does before handing over
+					expect_c(file, 'P');
+					next_c(file);
+					if(corpus->raw)
+						image = decoder == 0 ? read_p6_file(file) : read_p6_fast(file);
+					else
+						image = decoder == 0 ? read_p3_file(file) : read_p3_fast(file);
+					elapsed = now_seconds() - start;
+					if(round == 0 || elapsed < best) best = elapsed;
+					if(round == 0 && decoder == 0)
+						reference_hash = image_hash(image);
+					else if(round == 0 && image_hash(image) != reference_hash){
+						fprintf(stderr, "Error: The %s decoder disagrees with the reference on %s %s\n",
+								DecoderNames[decoder], corpus->name, size);
+						exit(1);
+					}
+					free_triple(image);
+				}
+				printf("%-18s %11s %-9s %9.1f %9.1f %9.2f %9.1f %6.1f\n", corpus->name, size, DecoderNames[decoder],
+						file_megabytes / best, (double) image_width * image_height / 1e6 / best, best * 1000,
+						peak_rss_megabytes(), (double) (decode_allocations - allocations) / DECODE_ROUNDS);
+				fflush(stdout);
+			}
+			fclose(file);
+		}
+	return EXIT_SUCCESS;
 }
 
-Triple* read_ppm_file(char* inputName){	//Figure out type of file, and calle read_p3_file or read_p6_file
-	Triple* texture_struct;
-	FILE* inputFile = fopen(inputName, "rb");	//Open input file
-	if(inputFile == NULL){	//If file does not exist, throw error
-		fprintf(stderr, "Error: File does not exist\n");
+int run_benchmark(char* name){	//--benchmark NAME
+	if(strcmp(name, "affine") == 0)
+		return run_affine_benchmark();
+	if(strcmp(name, "decode") == 0)
+		return run_decode_benchmark();
+	fprintf(stderr, "Error: Benchmark must be affine or decode\n");
+	return EXIT_FAILURE;
+}
+//-------------------------------------
+
+//Input replay -----------------------------
+
+void start_recording(){	//Log input from here on, times are relative to now
+	replay.record_start = now_seconds();
+	input_now = replay.record_start;
+	fprintf(record_file, "ezview-events 1\n");
+}
+
+void start_replay(){	//Open the --replay log, the window's own input is ignored from here on
+	char header[64];
+	replay.file = fopen(replay_name, "r");
+	if(replay.file == NULL){
+		fprintf(stderr, "Error: Could not open %s\n", replay_name);
 		exit(1);
 	}
-	skip_comts_ws(inputFile);	//Skip comments and whitespace
-	expect_c(inputFile, 'P');	//Expect a P
-	int c = next_c(inputFile);	//Get next magic number
-	if(c == '3'){				//If three, call our p3 function
-		texture_struct = read_p3_file(inputFile);
-	}else if(c == '6'){			//If six, call our p6 function
-		texture_struct = read_p6_file(inputFile);
-	}else{						//Else, invalid file
-		fprintf(stderr, "Error: Incorrect ppm file number on line %d", line);
+	if(fgets(header, sizeof(header), replay.file) == NULL || strcmp(header, "ezview-events 1\n") != 0){
+		fprintf(stderr, "Error: %s is not an ezview event log\n", replay_name);
+		exit(1);
+	}
+	if(metrics_file == NULL)	//Per frame timings are the point of a replay
+		start_metrics_file(stdout);
+	replay.start = now_seconds();
+}
+
+int replay_step(){	//Feed logged events to the callbacks up to the next loop step, 0 at the end of the log
+	char line[256];
+	double t, x, y;
+	int key, scancode, action, mods, button, new_width, new_height;
+	while(fgets(line, sizeof(line), replay.file) != NULL){
+		if(sscanf(line + 1, "%lf", &t) != 1) continue;
+		input_now = REPLAY_EPOCH + t;	//The same clock every replay, so the view comes out identical
+		while(!replay_fast && now_seconds() - replay.start < t)	//Original speed
+			sleep_ms(1);
+		if(line[0] == 'F'){
+			replay.steps++;
+			return 1;
+		}
+		replay.events++;
+		if(sscanf(line, "K %lf %d %d %d %d", &t, &key, &scancode, &action, &mods) == 5 && key >= 0 &&
+				key <= GLFW_KEY_LAST){
+			replay.keys[key] = action != GLFW_RELEASE;
+			key_callback(window, key, scancode, action, mods);
+		}else if(sscanf(line, "S %lf %lf %lf %lf %lf", &t, &x, &y, &replay.cursor_x, &replay.cursor_y) == 5){
+			scroll_callback(window, x, y);
+		}else if(sscanf(line, "B %lf %d %d %d %lf %lf", &t, &button, &action, &mods, &replay.cursor_x,
+							&replay.cursor_y) == 6){
+			mouse_button_callback(window, button, action, mods);
+		}else if(sscanf(line, "C %lf %lf %lf", &t, &replay.cursor_x, &replay.cursor_y) == 3){
+			cursor_position_callback(window, replay.cursor_x, replay.cursor_y);
+		}else if(sscanf(line, "W %lf %d %d", &t, &new_width, &new_height) == 3){
+			glfwSetWindowSize(window, new_width, new_height);	//Assumes the window and framebuffer sizes match
+			framebuffer_size_callback(window, new_width, new_height);
+		}else
+			replay.events--;
+	}
+	return 0;
+}
+
+void finish_replay(){
+	fprintf(stderr, "Replayed %ld events over %ld loop steps, %ld frames in %.3f s\n", replay.events, replay.steps,
+			frame_count, now_seconds() - replay.start);
+	fclose(replay.file);
+	replay.file = NULL;
+}
+//-------------------------------------
+
+void parse_arguments(int argc, char** argv, char** input_name){	//Read command line options
+	int i;
+	*input_name = NULL;
+	for(i = 1; i < argc; i++){
+		if(strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc){	//Texture budget in megabytes
+			texture_budget = (size_t) (atof(argv[++i]) * 1024 * 1024);
+		}else if(strcmp(argv[i], "--acceleration") == 0 && i + 1 < argc){	//Held key speed curve
+			i++;
+			if(strcmp(argv[i], "none") == 0) acceleration = 0;
+			else if(strcmp(argv[i], "linear") == 0) acceleration = 1;
+			else if(strcmp(argv[i], "quadratic") == 0) acceleration = 2;
+			else{
+				fprintf(stderr, "Error: Acceleration must be none, linear or quadratic\n");
+				exit(1);
+			}
+		}else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc){	//Resampling filter
+			i++;
+			for(resample_filter = 0; resample_filter < FILTER_COUNT; resample_filter++)
+				if(strcmp(argv[i], FilterNames[resample_filter]) == 0) break;
+			if(resample_filter == FILTER_COUNT){
+				fprintf(stderr, "Error: Filter must be nearest, bilinear, bicubic or lanczos3\n");
+				exit(1);
+			}
+		}else if(strcmp(argv[i], "--compare") == 0 && i + 1 < argc){	//GPU against CPU results to a CSV
+			compare_output = argv[++i];
+		}else if(strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc){	//For --compare, in dB
+			compare_tolerance = atof(argv[++i]);
+		}else if(strcmp(argv[i], "--headless") == 0 && i + 1 < argc){	//Offscreen render to a PPM
+			headless_output = argv[++i];
+		}else if(strcmp(argv[i], "--software") == 0 && i + 1 < argc){	//CPU render to a PPM
+			software_output = argv[++i];
+		}else if(strcmp(argv[i], "--out") == 0 && i + 1 < argc){	//Batch transform to a PPM
+			batch_output = argv[++i];
+		}else if(strcmp(argv[i], "--memory") == 0 && i + 1 < argc){	//In-flight limit for directory batches, in megabytes
+			batch_memory = (size_t) (atof(argv[++i]) * 1024 * 1024);
+		}else if(strcmp(argv[i], "--rotate") == 0 && i + 1 < argc){
+			add_transform_option(MOTION_ROTATE, argv[++i]);
+		}else if(strcmp(argv[i], "--scale") == 0 && i + 1 < argc){
+			add_transform_option(MOTION_SCALE, argv[++i]);
+		}else if(strcmp(argv[i], "--shear") == 0 && i + 1 < argc){
+			add_transform_option(MOTION_SHEAR, argv[++i]);
+		}else if(strcmp(argv[i], "--translate") == 0 && i + 1 < argc){
+			add_transform_option(MOTION_TRANSLATE, argv[++i]);
+		}else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+			thread_count = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+			headless_frames = atoi(argv[++i]);
+			if(headless_frames < 1){
+				fprintf(stderr, "Error: --frames must be at least 1\n");
+				exit(1);
+			}
+		}else if(strcmp(argv[i], "--thumb-db") == 0 && i + 1 < argc){	//Thumbnail database file
+			thumb_db.path = argv[++i];
+		}else if(strcmp(argv[i], "--watch") == 0){	//Reload the shown file when it changes
+			watch_enabled = 1;
+		}else if(strcmp(argv[i], "--grid") == 0){	//Start on the contact sheet
+			sheet_toggle = 1;
+		}else if(strcmp(argv[i], "--overlay") == 0){
+			show_overlay = 1;
+		}else if(strcmp(argv[i], "--metrics") == 0 && i + 1 < argc){	//Per frame CSV
+			FILE* file = fopen(argv[++i], "w");
+			if(file == NULL){
+				fprintf(stderr, "Error: Could not open %s for writing\n", argv[i]);
+				exit(1);
+			}
+			start_metrics_file(file);
+		}else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc){	//Chrome trace event JSON, written at exit
+			start_trace(argv[++i]);
+		}else if(strcmp(argv[i], "--startup-report") == 0 && i + 1 < argc){	//Time cold and warm startups, then exit
+			startup.runs = atoi(argv[++i]);
+			if(startup.runs < 1){
+				fprintf(stderr, "Error: --startup-report must time at least 1 run\n");
+				exit(1);
+			}
+		}else if(strcmp(argv[i], "--startup-child") == 0 && i + 1 < argc){	//Set by --startup-report, not for users
+			startup.child = 1;
+			startup.spawned = atof(argv[++i]);
+			startup.marks[STARTUP_PROCESS] = startup.main_entry;
+		}else if(strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc){	//Linked program directory, or off
+			i++;
+			if(strcmp(argv[i], "off") == 0)
+				program_cache.state = -1;
+			else
+				program_cache.path = argv[i];
+		}else if(strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc){	//Microbenchmark, then exit
+			benchmark_name = argv[++i];
+		}else if(strcmp(argv[i], "--decode-megapixels") == 0 && i + 1 < argc){	//Corpus size limit for --benchmark decode
+			decode_megapixels = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc){	//Input event log
+			record_file = fopen(argv[++i], "w");
+			if(record_file == NULL){
+				fprintf(stderr, "Error: Could not open %s for writing\n", argv[i]);
+				exit(1);
+			}
+		}else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc){	//Input event log to play back
+			replay_name = argv[++i];
+		}else if(strcmp(argv[i], "--replay-speed") == 0 && i + 1 < argc){
+			i++;
+			if(strcmp(argv[i], "original") == 0) replay_fast = 0;
+			else if(strcmp(argv[i], "max") == 0) replay_fast = 1;
+			else{
+				fprintf(stderr, "Error: Replay speed must be original or max\n");
+				exit(1);
+			}
+		}else if(strncmp(argv[i], "--", 2) == 0){
+			fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+			exit(1);
+		}else{
+			if(*input_name == NULL) *input_name = argv[i];	//The first is shown, the rest are browsed to
+			add_browse_name(argv[i]);
+		}
+	}
+	if(*input_name == NULL && benchmark_name == NULL){
+		fprintf(stderr, "Usage: ezview [--rotate DEG] [--scale K] [--shear X,Y] [--translate X,Y] [--out result.ppm|dir [--memory MB]] [--texture-budget MB] [--acceleration none|linear|quadratic] [--filter nearest|bilinear|bicubic|lanczos3] [--grid] [--thumb-db FILE] [--watch] [--overlay] [--metrics out.csv] [--trace out.json] [--shader-cache DIR|off] [--record events.log | --replay events.log [--replay-speed original|max]] [--headless out.ppm | --software out.ppm | --compare results.csv [--tolerance DB]] [--frames N] [--threads N] [--startup-report RUNS] input.ppm\n"
+						"       ezview --benchmark affine|decode [--decode-megapixels MP]\n");
 		exit(1);
 	}
-	fclose(inputFile);	//Close file
-	return texture_struct;	//Return struct containing image information
 }
 
 int main(int argc, char** argv) {	//Execute our program
 	Triple* texture_struct;
 	VariableArray* our_variables;
-	int i, j;
-	GLint program_id, mvp_slot, position_slot, color_slot, texture_slot, textureUniform;
-	GLuint myTexture;
-	texture_struct = read_ppm_file(argv[1]);	//Read and retrieve pixel information
+	char* input_name;
+	GLuint myTexture, vertex_buffer;
+	int presented = 0;	//Set after the first swap
+	startup.main_entry = now_seconds();
+	parse_arguments(argc, argv, &input_name);
+	if(benchmark_name != NULL)	//No image needed
+		exit(run_benchmark(benchmark_name));
+	if(startup.runs > 0)	//Start this command line repeatedly as child processes and time them
+		exit(run_startup_report(argc, argv, input_name));
+	init_kernel_tables();
+	startup_mark(STARTUP_ARGUMENTS);
+	if(batch_output != NULL && is_directory(input_name))	//Whole directory through the batch pipeline
+		exit(run_batch_directory(input_name, batch_output));
+	if(compare_output != NULL)	//File or directory against the CPU reference
+		exit(run_compare(input_name));
+	if(is_directory(input_name)){	//Browse the images in it
+		browse_directory(input_name);
+		input_name = browser.names[0];
+	}
+	texture_struct = read_ppm_file(input_name);	//Read and retrieve pixel information
+	startup_mark(STARTUP_DECODE);
+	
+	reset_view();	//Start from the untransformed image
+	if(batch_output != NULL)	//Transform and write at image size, no display
+		exit(run_batch(texture_struct, batch_output));
+	pick_window_size(texture_struct);
+	apply_transform_options();	//Command line transforms set the starting view
+	if(headless_output != NULL)	//No window wanted, render offscreen and exit
+		exit(run_headless(texture_struct, headless_output));
+	if(software_output != NULL)	//No GPU wanted either
+		exit(run_software(texture_struct, software_output));
 
 	// Initialize GLFW library
 	if (!glfwInit())
 		return -1;
+	startup_mark(STARTUP_GLFW);
 
 	glfwSetErrorCallback(error_callback);	//Initialize error callback function
 	
 	set_window_hints();	//Set OpenGL settings
 
-	width = texture_struct->width;
-	height = texture_struct->height;
-	while(width < 1400 && height < 750){
-		width += texture_struct->width/2;
-		height += texture_struct->height/2;
-	}
-	width -= texture_struct->width/2;
-	height -= texture_struct->height/2;
 	// Create and open a window
 	window = glfwCreateWindow(width,
 							height,
@@ -535,63 +5730,91 @@ int main(int argc, char** argv) {	//Execute our program
 		exit(1);
 	}
 
-	glfwSetKeyCallback(window, key_callback);	//Initialize key listener
+	if(replay_name != NULL)	//Input comes from the log instead
+		start_replay();
+	else{
+		glfwSetKeyCallback(window, key_callback);	//Initialize key listener
+		glfwSetScrollCallback(window, scroll_callback);			//Wheel zoom and drag panning
+		glfwSetMouseButtonCallback(window, mouse_button_callback);
+		glfwSetCursorPosCallback(window, cursor_position_callback);
+	}
+	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);	//Redraw only on damage
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
 	glfwMakeContextCurrent(window);				//Make window current
+	startup_mark(STARTUP_WINDOW);
 	
-	//Texture Setup -----------------------------
-	myTexture = new_texture(texture_struct);
-
-	program_id = simple_program();	//Set up program
-
-	glUseProgram(program_id);	//Use program
-	
-	our_variables = get_shader_variables(program_id);	//Get shader variable locations
-	
-	bind_buffer();	//Create, bind, and send buffer
-	
-	mat4x4_identity(mvp);	//Create new transformation array, that starts as an identity matrix
-	
-	glVertexAttribPointer(our_variables->position_slot,	//Send position information to vertex shader
-							  3,
-							  GL_FLOAT,
-							  GL_FALSE,
-							  sizeof(Vertex),
-							  0);
-							  
-	glVertexAttribPointer(our_variables->color_slot,	//Send color information to vertex shader
-							  4,
-							  GL_FLOAT,
-							  GL_FALSE,
-							  sizeof(Vertex),
-							  (GLvoid*) (sizeof(float) * 3));
-	glVertexAttribPointer(our_variables->texture_slot,	//Send texture information to vertex shader
-							  2,
-							  GL_FLOAT,
-							  GL_FALSE,
-							  sizeof(Vertex),
-							  (GLvoid*) (sizeof(float) * 7));
-	
-	glActiveTexture(GL_TEXTURE0);	//Make texture active
-	glBindTexture(GL_TEXTURE_2D, myTexture);	//Bind texture to window
-	glUniform1i(our_variables->textureUniform, 0);	//Get ready to use texture information retrieved from fragment shader
+	our_variables = setup_renderer(texture_struct, &myTexture, &vertex_buffer);
+	if(browser.count > 1)	//PageDown and PageUp step through the list
+		start_browsing(texture_struct);
+	if(watch_enabled)	//Reload when the file is rewritten
+		watch_file(input_name);
 	
 	glfwGetFramebufferSize(window, &width, &height);	//Get size of window
-	glViewport(0, 0, width,  height);	//Set Viewport size, and set it to size of window
+	cached_viewport(0, 0, width,  height);	//Set Viewport size, and set it to size of window
+	if(record_file != NULL)
+		start_recording();
+	startup_mark(STARTUP_SETUP);
 	while (!glfwWindowShouldClose(window)) {
-		
-		glClearColor(0, 104.0/255.0, 55.0/255.0, 1.0);	//Clear window color
-		glClear(GL_COLOR_BUFFER_BIT);
-							  					
-        glUniformMatrix4fv(our_variables->mvp_slot, 1, GL_FALSE, (const GLfloat*) mvp);	//Send transform. matrix to vertex shader
-		
-		glDrawElements(GL_TRIANGLES,	//Draw everything
-					   sizeof(Indices) / sizeof(GLubyte),
-					   GL_UNSIGNED_BYTE, 0);
+		int drew = needs_redraw;
+		if(replay.file != NULL && !replay_step())	//Events up to the next logged loop step
+			break;
+		stamp_input();
+		record_event('F', "");	//One per loop step, so held keys integrate over the same times in a replay
+		if(browse_step != 0){	//Several presses in one frame skip straight to the last
+			if(browser.count > 1)
+				myTexture = show_image(((browser.current + browse_step) % browser.count + browser.count) % browser.count);
+			browse_step = 0;
+		}
+		if(sheet_toggle){
+			if(browser.count > 1)
+				toggle_sheet();
+			sheet_toggle = 0;
+		}
+		if(browser.count > 1)
+			warm_textures();	//Upload neighbours the workers finished decoding
+		if(sheet.active)
+			pack_thumbnails();
+		if(watch_enabled && watch.reloaded != NULL)	//The watched file changed and has been decoded
+			myTexture = apply_reload(myTexture);
+		update_motion();	//Apply held keys for the time since the last frame
+		update_inertia();
+		drew |= needs_redraw;
+		if(needs_redraw){	//Only draw when something changed since the last frame
+			double swap_start;
+			long scope = trace_begin("frame", "frame");
+			needs_redraw = 0;
+			begin_frame_metrics();
+			if(sheet.active)
+				render_sheet_frame(our_variables);
+			else
+				render_frame(vertex_buffer, myTexture, our_variables);
 
-		glfwSwapBuffers(window);	//Display buffer of stuff drawn
-		glfwPollEvents();			//Listen for keypress or error events
+			swap_start = now_seconds();
+			glfwSwapBuffers(window);	//Display buffer of stuff drawn
+			end_frame_metrics(swap_start, now_seconds());
+			trace_end(scope);
+			if(!presented){
+				trace_instant("frame", "first present");
+				presented = 1;
+				if(startup.child){	//Timed startup, this is the frame the user sees first
+					startup_mark(STARTUP_FIRST_FRAME);
+					finish_startup();
+				}
+			}
+		}
+		if(replay.file != NULL || (animating && drew))
+			glfwPollEvents();		//Keep frames coming while something is moving, or the log has more
+		else if(animating)
+			glfwWaitEventsTimeout(0.005);	//Moving soon, but nothing to draw yet
+		else
+			glfwWaitEvents();		//Sleep until a keypress, resize or wake up
 	}
 	//-------------------------------------
+	finish_metrics();
+	if(replay.file != NULL)
+		finish_replay();
+	if(record_file != NULL)
+		fclose(record_file);
 	
 	glfwDestroyWindow(window);	//Destroy window
 	glfwTerminate();			//Terminate program